@@ -11,6 +11,11 @@ enum msg_type_t
 	// ACK payload (dongle -> keyboard)
 	MT_LED_STATUS,			// update the status of the LEDs
 	MT_TEXT_BUFF_FREE,		// number of free chars in the message text buffer on the dongle
+	MT_TIMING_BEACON,		// how long the last key state waited for the USB poll
+
+	// keyboard -> dongle; added after the ACK payloads so the old numbers stay the same
+	MT_KEEP_ALIVE,			// the keys of the last key state are still down
+	MT_HEARTBEAT,			// the keyboard's battery and RF counters
 };
 
 // communication address
@@ -21,6 +26,14 @@ extern const __FLASH_ATTR uint8_t DongleAddr[NRF_ADDR_SIZE];
 // the maximum number of keys that the one packet will carry
 #define MAX_KEYS		6
 
+// The link supervision. While keys are down the keyboard sends a MT_KEEP_ALIVE
+// at least every KEEP_ALIVE_MS. If the dongle hears nothing for LINK_TIMEOUT_MS
+// while it has keys down, the keyboard is gone (out of range, dead battery) and
+// the dongle releases the keys, so the host doesn't auto repeat them forever.
+// The timeout leaves room for a lost keep-alive and the first retries after it.
+#define KEEP_ALIVE_MS		100
+#define LINK_TIMEOUT_MS		300
+
 // the nRF channel that we are communicating on
 #define CHANNEL_NUM		110
 
@@ -40,6 +53,20 @@ typedef struct
 	uint8_t		keys[MAX_KEYS];
 } rf_msg_key_state_report_t;
 
+// The heartbeat goes out every few seconds while typing, and about once a minute
+// while idle. It tells the dongle how the keyboard is doing, and its ACK brings
+// back the LED status the host has changed in the meantime.
+typedef struct
+{
+	uint8_t		msg_type;			// == MT_HEARTBEAT
+	uint16_t	battery_voltage;	// in 10mV
+	uint8_t		battery_level;		// BATT_LEVEL_* of keyb_ctrl/battery.h
+	uint16_t	packets;			// the low 16 bits of the keyboard's totals
+	uint16_t	lost_packets;
+	uint16_t	retransmits;
+	uint8_t		link_losses;		// since power up, see keyb_ctrl/link.h
+} rf_msg_heartbeat_t;
+
 #define MAX_TEXT_LEN	30
 
 typedef struct
@@ -61,10 +88,17 @@ typedef struct
 typedef struct
 {
 	uint8_t		msg_type;		// == MT_TEXT_BUFF_FREE
-	uint8_t		bytes_free;
-	uint8_t		bytes_capacity;
+	uint16_t	bytes_free;
+	uint16_t	bytes_capacity;
 } rf_msg_text_buff_state_t;
 
+typedef struct
+{
+	uint8_t		msg_type;		// == MT_TIMING_BEACON
+	uint16_t	wait_us;		// from reading the last key state message to the host's IN token
+								// 0xffff if the dongle doesn't know when the host polls
+} rf_msg_timing_beacon_t;
+
 /*
 // this one is only used for tests
 typedef struct
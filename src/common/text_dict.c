@@ -0,0 +1,109 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifndef NRF24LU1
+# include <avr/pgmspace.h>
+#endif
+
+#include "tgtdefs.h"
+#include "text_dict.h"
+
+// The dictionary of the phrases and words used by the menu.
+// Each entry is a length byte followed by the chars of the entry (not zero terminated),
+// a zero length ends the dictionary. The token for an entry is TEXT_DICT_TOKEN_FLAG | index.
+//
+// The keyboard and the dongle have to be built with the same dictionary,
+// so only append new entries at the end, and keep them under 128.
+__FLASH_ATTR const char text_dict[] =
+	"\x0c" "7G wireless\n"							// 0x80
+	"\x0f" "firmware build "						// 0x81
+	"\x11" "battery voltage: "						// 0x82
+	"\x0f" "RF packet stats"						// 0x83
+	"\x1a" " (total/retransmit/lost): "				// 0x84
+	"\x17" "keyboard's been on for "				// 0x85
+	"\x18" "what do you want to do?\n"				// 0x86
+	"\x0a" " - change "								// 0x87
+	"\x18" "transmitter output power"				// 0x88
+	"\x0a" " (current "								// 0x89
+	"\x0e" "LED brightness"							// 0x8a
+	"\x0d" "lock keyboard"							// 0x8b
+	"\x0e" "Func+Del+LCtrl"							// 0x8c
+	"\x09" " - reset "								// 0x8d
+	"\x15" " - refresh this menu\n"					// 0x8e
+	"\x10" "Esc - exit menu\n"						// 0x8f
+	"\x06" " days "									// 0x90
+	"\x07" " hours "								// 0x91
+	"\x09" " minutes "								// 0x92
+	"\x09" " seconds\n"								// 0x93
+	"\x03" "dBm"									// 0x94
+	"\x0e" "select power:\n"						// 0x95
+	"\x06" "press "									// 0x96
+	"\x06" "unlock"									// 0x97
+	"\x1f" "exiting menu, you can type now\n"		// 0x98
+	"\x1a" "Keyboard is now LOCKED!!!\n"			// 0x99
+	"\x0f" " for brightness"						// 0x9a
+	"\x10" ", Esc to finish\n"						// 0x9b
+	"\x0a" " (dim) to "								// 0x9c
+	"\x09" " (bright)"								// 0x9d
+	"\x08" "keyboard"								// 0x9e
+	"\x04" "menu"									// 0x9f
+	"\x05" " the "									// 0xa0
+	"\x05" " and "									// 0xa1
+	"\x00";
+
+const __FLASH_ATTR char* text_dict_entry(uint8_t token, uint8_t* len)
+{
+	const __FLASH_ATTR char* entry = text_dict;
+	
+	token &= ~TEXT_DICT_TOKEN_FLAG;
+
+	// walk the entries until we reach the one we need
+	while (*entry)
+	{
+		if (token-- == 0)
+		{
+			*len = *entry;
+			return entry + 1;
+		}
+		
+		entry += *entry + 1;
+	}
+
+	return NULL;
+}
+
+#ifndef NRF24LU1
+
+// finds the longest dictionary entry that matches the start of msg
+// returns the length of the match (0 if none) and the token of the entry in token
+uint8_t text_dict_match(const char* msg, bool is_flash, uint16_t msglen, uint8_t* token)
+{
+	const __FLASH_ATTR char* entry = text_dict;
+	uint8_t best_len = 0;
+	uint8_t entry_len, ndx, cnt;
+	char first = is_flash ? pgm_read_byte(msg) : *msg;
+
+	for (ndx = 0; (entry_len = *entry++) != 0; ++ndx, entry += entry_len)
+	{
+		// most entries fail on the first char, so check that one first
+		if (entry_len <= best_len  ||  entry_len > msglen  ||  *entry != first)
+			continue;
+
+		for (cnt = 1; cnt < entry_len; ++cnt)
+		{
+			if ((is_flash ? pgm_read_byte(msg + cnt) : msg[cnt]) != entry[cnt])
+				break;
+		}
+
+		if (cnt == entry_len)
+		{
+			best_len = entry_len;
+			*token = TEXT_DICT_TOKEN_FLAG | ndx;
+		}
+	}
+
+	return best_len;
+}
+
+#endif
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "tgtdefs.h"
+
+// chars with the high bit set in the MT_TEXT payload are not sent to the host as they are;
+// they are tokens which the dongle expands into the dictionary entry with the index in the low 7 bits
+#define TEXT_DICT_TOKEN_FLAG	0x80
+#define IS_TEXT_DICT_TOKEN(c)	((uint8_t)(c) & TEXT_DICT_TOKEN_FLAG)
+
+// the dictionary: length prefixed entries ending with a zero length
+extern __FLASH_ATTR const char text_dict[];
+
+// returns the chars of the dictionary entry for the token and its length in len,
+// or NULL if there is no such entry
+const __FLASH_ATTR char* text_dict_entry(uint8_t token, uint8_t* len);
+
+#ifndef NRF24LU1
+
+// only the keyboard encodes; msg is in flash if is_flash is set
+uint8_t text_dict_match(const char* msg, bool is_flash, uint16_t msglen, uint8_t* token);
+
+#endif
@@ -39,13 +39,13 @@ int	main(void)
 
 	sei();
 
-	const uint8_t RECV_BUFF_SIZE = 32;
-	uint8_t recv_buffer[RECV_BUFF_SIZE];
+	const uint8_t* recv_buffer;
 	uint8_t bytes_received;
 
 	bool keyboard_report_ready = false;
 	bool consumer_report_ready = false;
 	bool idle_elapsed = false;
+	uint8_t ticks, prev_ticks = 0;
 	
 	dprint("dongle online\n");
 	
@@ -53,11 +53,13 @@ int	main(void)
 	{
 		idle_elapsed = vusb_poll();
 
-		// try to read the recv buffer
-		bytes_received = rf_dngl_recv(recv_buffer, RECV_BUFF_SIZE);
+		// try to read the recv buffer; the message is processed where the driver put it
+		recv_buffer = rf_dngl_recv_direct(&bytes_received);
 
 		if (bytes_received)
 		{
+			link_heard();
+
 			// we have new data, so what is it?
 			if (recv_buffer[0] == MT_KEY_STATE)
 			{
@@ -67,10 +69,22 @@ int	main(void)
 				keyboard_report_ready = true;
 			} else if (recv_buffer[0] == MT_TEXT) {
 				process_text_msg(recv_buffer, bytes_received);
+			} else if (recv_buffer[0] == MT_HEARTBEAT) {
+				process_heartbeat_msg(recv_buffer, bytes_received);
 			}
 		}
 
-		if (!keyboard_report_ready  &&  !msg_empty())
+		// release the keys if the keyboard is gone
+		ticks = vusb_get_ticks();
+		if (link_check((uint8_t)(ticks - prev_ticks) * VUSB_TICK_MS))
+		{
+			consumer_report_ready = true;
+			keyboard_report_ready = true;
+		}
+		prev_ticks = ticks;
+
+		// type the text only if the host tool is not reading it through the text report
+		if (!vusb_text_enabled()  &&  !keyboard_report_ready  &&  !msg_empty())
 		{
 			reset_keyboard_report();
 
@@ -108,8 +122,20 @@ int	main(void)
 		// send the audio and media controls report
         if (usbInterruptIsReady3()  &&  (consumer_report_ready  ||  idle_elapsed))
 		{
-            usbSetInterrupt3((void*) &usb_consumer_report, sizeof usb_consumer_report);
+            usbSetInterrupt3(vusb_make_consumer_report(), 2);
 			consumer_report_ready = false;
+			
+		} else if (usbInterruptIsReady3()  &&  vusb_text_enabled()  &&  !msg_empty()) {
+
+			// send the text to the host tool in the vendor report
+			static uint8_t text_report[VUSB_TEXT_REPORT_SIZE];
+			uint8_t len = msg_pop_text((char*) text_report + 2, VUSB_TEXT_REPORT_SIZE - 2);
+			if (len)
+			{
+				text_report[0] = TEXT_REPORT_ID;
+				text_report[1] = len;
+				usbSetInterrupt3(text_report, VUSB_TEXT_REPORT_SIZE);
+			}
 		}
 	}
 
@@ -19,6 +19,7 @@
 
 uint8_t vusb_idle_rate;				// in 4 ms units - set by SET_IDLE
 uint8_t vusb_idle_counter;
+uint8_t vusb_ticks = 0;				// Timer0 overflows
 
 uint8_t vusb_curr_protocol;			// this one's a little pointless because in our case both the boot
 									// protocol and the report protocol are the same, but we'll support
@@ -26,6 +27,12 @@ uint8_t vusb_curr_protocol;			// this one's a little pointless because in our ca
 
 
 uint8_t vusb_expect_data = 0;		// used by usbFunctionSetup to send messages to usbFunctionWrite
+bool vusb_expect_text_ctrl = false;	// the next usbFunctionWrite is the text report enable/disable
+
+uint8_t vusb_consumer_report[2];	// the consumer report with the report ID in front
+
+uint8_t vusb_text_timeout = 0;		// the text reports are enabled while this is not 0
+									// counts down on every Timer0 overflow (21.8ms)
 
 #define CFG_INTERFACE_KEYBOARD_NAME		'7','G',' ','K','e','y','b','o','a','r','d'
 #define CFG_INTERFACE_KEYBOARD_SZ   	11
@@ -73,11 +80,14 @@ const PROGMEM char keyboard_report_descriptor[] =
 };
 
 // media control report
+// V-USB gives us only two interrupt IN endpoints, so the vendor defined text report
+// shares the interface and the endpoint with the consumer report. This is why we need report IDs here.
 const PROGMEM char consumer_report_descriptor[] =
 {
 	0x05, 0x0c,			// Usage Page (Consumer Devices)	
 	0x09, 0x01,			// Usage (Consumer Control)	
 	0xa1, 0x01,			// Collection (Application)	
+	0x85, CONSUMER_REPORT_ID,	//		Report ID (1)
 	0x15, 0x00,			//		Logical Minimum (0)	
 	0x25, 0x01,			//		Logical Maximum (1)	
 	0x09, 0xe2,			//		Usage (Mute)
@@ -97,7 +107,23 @@ const PROGMEM char consumer_report_descriptor[] =
 	0x81, 0x62,			//		Input (Data,Var,Abs,NWrp,Lin,NPrf,Null,Bit)
 	0x95, 0x02,			//		Report Count (2)
 	0x81, 0x01,			//		Input (Cnst,Ary,Abs)
-	0xc0				// End Collection
+	0xc0,				// End Collection
+
+	// the text messages for the host tool
+	0x06, 0x00, 0xff,	// USAGE_PAGE (Vendor Defined Page 1)
+	0x09, 0x01,			// USAGE (Vendor Usage 1)
+	0xa1, 0x01,			// COLLECTION (Application)
+	0x85, TEXT_REPORT_ID,	//		REPORT_ID (2)
+	0x15, 0x00,			//		LOGICAL_MINIMUM (0)
+	0x26, 0xff, 0x00,	//		LOGICAL_MAXIMUM (255)
+	0x75, 0x08,			//		REPORT_SIZE (8)
+	0x95, 0x07,			//		REPORT_COUNT (7)
+	0x09, 0x01,			//		USAGE (Vendor Usage 1)
+	0x81, 0x02,			//		INPUT (Data,Var,Abs)	- length byte followed by the text
+	0x95, 0x01,			//		REPORT_COUNT (1)
+	0x09, 0x01,			//		USAGE (Vendor Usage 1)
+	0x91, 0x02,			//		OUTPUT (Data,Var,Abs)	- enable/disable the text reports
+	0xc0				// END_COLLECTION
 };
 
 // contains the configuration descriptor and all the interface, HID and endpoint descritors as well
@@ -227,11 +253,16 @@ bool vusb_poll(void)
 
 	bool ret_val = false;
 	
-	// take care of the idle rate
-	if (vusb_idle_rate  &&  (TIFR0  &  _BV(TOV0)))		// timer overflow?
+	// take care of the idle rate and the text report timeout
+	if (TIFR0  &  _BV(TOV0))		// timer overflow?
 	{
 		TIFR0 = _BV(TOV0);
 
+		++vusb_ticks;
+
+		if (vusb_text_timeout)
+			--vusb_text_timeout;
+
 		if (vusb_idle_rate != 0)
 		{
 			if (vusb_idle_counter > 4)
@@ -247,6 +278,24 @@ bool vusb_poll(void)
 	return ret_val;
 }
 
+uint8_t vusb_get_ticks(void)
+{
+	return vusb_ticks;
+}
+
+uint8_t* vusb_make_consumer_report(void)
+{
+	vusb_consumer_report[0] = CONSUMER_REPORT_ID;
+	vusb_consumer_report[1] = usb_consumer_report;
+	
+	return vusb_consumer_report;
+}
+
+bool vusb_text_enabled(void)
+{
+	return vusb_text_timeout != 0;
+}
+
 void vusb_reset_idle(void)
 {
 	vusb_idle_counter = vusb_idle_rate;
@@ -270,8 +319,8 @@ uchar usbFunctionSetup(uchar data[8])
 				usbMsgPtr = (usbMsgPtr_t) &usb_keyboard_report;
 				return sizeof usb_keyboard_report;
 			} else if (rq->wIndex.word == 2)	{	// consumer interface
-				usbMsgPtr = (usbMsgPtr_t) &usb_consumer_report;
-				return 1;
+				usbMsgPtr = (usbMsgPtr_t) vusb_make_consumer_report();
+				return sizeof vusb_consumer_report;
 			}
 
 		} else if (rq->bRequest == USBRQ_HID_GET_IDLE) {
@@ -289,6 +338,10 @@ uchar usbFunctionSetup(uchar data[8])
             if (rq->wValue.word == 0x0200  &&  rq->wIndex.word == 0)
                  vusb_expect_data = rq->wLength.word;
 
+            // Report Type: 0x02(Out)/ReportID: TEXT_REPORT_ID && Interface: 1(consumer and text)
+            if (rq->wValue.word == (0x0200 | TEXT_REPORT_ID)  &&  rq->wIndex.word == 1)
+                 vusb_expect_text_ctrl = true;
+
             return USB_NO_MSG; // to get data in usbFunctionWrite
 
 		} else if(rq->bRequest == USBRQ_HID_GET_PROTOCOL) {
@@ -310,9 +363,17 @@ uchar usbFunctionSetup(uchar data[8])
 }
 
 // V-USB calls this function when we've got data from the PC.
-// In our case this will always be the state of the LEDs
+// This is either the state of the LEDs or the text report enable/disable
 uchar usbFunctionWrite(uchar *data, uchar len)
 {
+	if (vusb_expect_text_ctrl)
+	{
+		// data[0] is the report ID
+		vusb_text_timeout = data[1] ? (TEXT_REPORT_TIMEOUT_MS / 22) : 0;
+		vusb_expect_text_ctrl = false;
+		return 1;
+	}
+
 	if (vusb_expect_data == 0)
 		return -1;
 
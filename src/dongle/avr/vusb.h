@@ -2,7 +2,15 @@
 
 #include "usbdrv.h"
 
+// the report ID of the consumer report; the vendor text report uses TEXT_REPORT_ID
+#define CONSUMER_REPORT_ID		1
+#define VUSB_TEXT_REPORT_SIZE	8
+
 void vusb_init(void);
 
 bool vusb_poll(void);			// returns true if the idle duration has expired
+uint8_t vusb_get_ticks(void);	// free running count of the Timer0 overflows, VUSB_TICK_MS each
+#define VUSB_TICK_MS	22
 void vusb_reset_idle(void);		// resets the idle duration
+uint8_t* vusb_make_consumer_report(void);	// returns the consumer report with the report ID
+bool vusb_text_enabled(void);	// returns true if the host tool is reading the text reports
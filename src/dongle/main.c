@@ -39,8 +39,6 @@ void* memcpy_P(__xdata void* dest, __code const void* src, size_t count)
 	return dest;
 }
 
-#define RECV_BUFF_SIZE		32
-
 void main()
 {
 	bool keyboard_report_ready = false;
@@ -48,8 +46,10 @@ void main()
 
 	uint8_t prev_keycode = KC_NO;
 	
-	__xdata uint8_t recv_buffer[RECV_BUFF_SIZE];
+	__xdata const uint8_t* recv_buffer;
 	__xdata uint8_t bytes_received;
+	__xdata rf_msg_timing_beacon_t beacon;
+	uint8_t frame_count, prev_frame_count = 0;
 	
 	P0DIR = 0x00;	// all outputs
 	P0ALT = 0x00;	// all GPIO default behavior
@@ -68,25 +68,58 @@ void main()
 		usbPoll();	// handles USB interrupts
 		//dbgPoll();	// send chars from the uart TX buffer
 		
-		// try to read the recv buffer
-		bytes_received = rf_dngl_recv(recv_buffer, RECV_BUFF_SIZE);
+		// try to read the recv buffer; the message is processed where the driver put it
+		recv_buffer = rf_dngl_recv_direct(&bytes_received);
 
 		if (bytes_received)
 		{
+			link_heard();
+
 			// we have new data, so what is it?
 			if (recv_buffer[0] == MT_KEY_STATE)
 			{
 				process_key_state_msg(recv_buffer, bytes_received);
+				usbReportArrived();
+
+				// tell the keyboard how long the report waits for the host; this
+				// goes out with the next ACK unless something else is waiting
+				beacon.msg_type = MT_TIMING_BEACON;
+				beacon.wait_us = usbGetArrivalWaitUs();
+				rf_dngl_queue_ack_payload_if_free(&beacon, sizeof beacon);
 
 				consumer_report_ready = true;
 				keyboard_report_ready = true;
 			} else if (recv_buffer[0] == MT_TEXT) {
 				process_text_msg(recv_buffer, bytes_received);
+			} else if (recv_buffer[0] == MT_HEARTBEAT) {
+				process_heartbeat_msg(recv_buffer, bytes_received);
 			}
 		}
 
-		if (!keyboard_report_ready  &&  !msg_empty())
+		// release the keys if the keyboard is gone
+		frame_count = usbGetFrameCount();
+		if (link_check(frame_count - prev_frame_count))
+		{
+			consumer_report_ready = true;
+			keyboard_report_ready = true;
+		}
+		prev_frame_count = frame_count;
+
+		if (usbTextReportsEnabled())
 		{
+			// the host tool is reading the text; send it in a vendor report if EP3 is not busy
+			if ((in3cs & 0x02) == 0  &&  !msg_empty())
+			{
+				uint8_t len = msg_pop_text((__xdata char*) in3buf + 2, USB_EP3_SIZE - 2);
+				if (len)
+				{
+					in3buf[0] = TEXT_REPORT_ID;
+					in3buf[1] = len;
+					in3bc = USB_EP3_SIZE;
+				}
+			}
+			
+		} else if (!keyboard_report_ready  &&  !msg_empty()) {
 			// get the next char from the stored text message
 			uint8_t c = msg_peek();
 			uint8_t new_keycode = get_keycode_for_char(c);
@@ -110,8 +143,9 @@ void main()
 			prev_keycode = new_keycode;		// remember for later
 		}
 		
-		// send the report if the endpoint is not busy
-		if ((in1cs & 0x02) == 0   &&   (keyboard_report_ready  ||  usbHasIdleElapsed()))
+		// send the report if the endpoint is not busy, just before the host asks for it
+		if ((in1cs & 0x02) == 0
+				&&  ((keyboard_report_ready  &&  usbShouldStageReport())  ||  usbHasIdleElapsed(0)))
 		{
 			// copy the keyboard report into the endpoint buffer
 			in1buf[0] = usb_keyboard_report.modifiers;
@@ -125,15 +159,17 @@ void main()
 
 			// send the data on it's way
 			in1bc = 8;
+			usbReportArmed(0);
 			
 			keyboard_report_ready = false;
 		}
 
 		// send the consumer report if the endpoint is not busy
-		if ((in2cs & 0x02) == 0   &&   (consumer_report_ready  ||  usbHasIdleElapsed()))
+		if ((in2cs & 0x02) == 0   &&   (consumer_report_ready  ||  usbHasIdleElapsed(1)))
 		{
 			in2buf[0] = usb_consumer_report;
 			in2bc = 1;
+			usbReportArmed(1);
 		
 			consumer_report_ready = false;
 		}
@@ -14,6 +14,15 @@
 hid_kbd_report_t	usb_keyboard_report;
 uint8_t				usb_consumer_report;
 
+// the link supervision
+uint16_t link_silent_ms = 0;		// since the last packet from the keyboard
+bool link_keys_down = false;		// the last key state from the keyboard has keys down
+
+// the keyboard's health from the last heartbeat
+__xdata rf_msg_heartbeat_t keyboard_health;
+uint16_t heartbeat_age_sec = 0xffff;
+uint16_t heartbeat_age_ms = 0;		// the part of the age below a second
+
 // contains the last received LED report
 uint8_t usb_led_report;		// bit	LED
 							// 0	CAPS
@@ -47,12 +56,62 @@ void process_key_state_msg(__xdata const uint8_t* recv_buffer, const uint8_t byt
 	// copy the keycodes
 	for (key_cnt = 0; key_cnt < bytes_received - 3; key_cnt++)
 		usb_keyboard_report.keys[key_cnt] = key_state_msg->keys[key_cnt];
+
+	link_keys_down = key_state_msg->modifiers != 0  ||  key_state_msg->consumer != 0  ||  bytes_received > 3;
+}
+
+void link_heard(void)
+{
+	link_silent_ms = 0;
+}
+
+bool link_check(uint8_t elapsed_ms)
+{
+	// the ages stop at 0xffff
+	if (link_silent_ms <= 0xffff - elapsed_ms)
+		link_silent_ms += elapsed_ms;
+	else
+		link_silent_ms = 0xffff;
+
+	heartbeat_age_ms += elapsed_ms;
+	if (heartbeat_age_ms >= 1000)
+	{
+		heartbeat_age_ms -= 1000;
+		if (heartbeat_age_sec != 0xffff)
+			++heartbeat_age_sec;
+	}
+
+	// only the keys from the keyboard can get stuck; the text releases its own
+	if (!link_keys_down  ||  link_silent_ms < LINK_TIMEOUT_MS)
+		return false;
+
+	// the keyboard is gone, let go of everything it was holding
+	reset_keyboard_report();
+	usb_consumer_report = 0;
+	link_keys_down = false;
+
+	return true;
+}
+
+void process_heartbeat_msg(__xdata const uint8_t* recv_buffer, const uint8_t bytes_received)
+{
+	__xdata uint8_t* dest = (__xdata uint8_t*) &keyboard_health;
+	uint8_t cnt;
+
+	if (bytes_received < sizeof keyboard_health)
+		return;
+
+	for (cnt = 0; cnt < sizeof keyboard_health; ++cnt)
+		*dest++ = *recv_buffer++;
+
+	heartbeat_age_sec = 0;
+	heartbeat_age_ms = 0;
 }
 
 void process_text_msg(__xdata const uint8_t* recv_buffer, const uint8_t bytes_received)
 {
 	__xdata const rf_msg_text_t* msg = (__xdata const rf_msg_text_t*) recv_buffer;
-	const char* txt = msg->text;
+	__xdata const char* txt = msg->text;
 	const uint8_t txt_size = bytes_received - 2;
 	__xdata rf_msg_text_buff_state_t msg_ack;
 
@@ -60,22 +119,14 @@ void process_text_msg(__xdata const uint8_t* recv_buffer, const uint8_t bytes_re
 
 	if (txt_size  &&  prev_msg_id != msg->msg_id)
 	{
-		// also, check if we have enough space for the entire message
-		uint8_t buff_free = msg_free();
-		if (buff_free >= txt_size + 1)
+		// the keyboard checks for free space before sending the text, so this
+		// should always fit. if it doesn't, we keep as much as we can.
+		if (msg_free() > 0)
 		{
-			// copy the text to our ring buffer
-			uint8_t ndx = 0;
-			while (ndx < txt_size)
-				msg_push(txt[ndx++]);
+			// expand the text straight from the receive buffer into our ring buffer
+			msg_push_text(txt, txt_size);
 
 			msg_push(0);	// adds a key-up at the end of the message
-			
-		} else if (buff_free > 0) {
-			while (--buff_free)
-				msg_push('#');
-				
-			msg_push(0);
 		}
 
 		prev_msg_id = msg->msg_id;	// remember this message id
@@ -1,11 +1,46 @@
 #pragma once
 
 #include "tgtdefs.h"
+#include "rf_protocol.h"
+
+// The text messages can be sent to a host tool through a vendor defined HID report
+// instead of being typed as keystrokes. The host tool enables this by sending
+// the output report {TEXT_REPORT_ID, 1} and has to repeat it at least every
+// TEXT_REPORT_TIMEOUT_MS, otherwise we fall back to typing the text.
+// The input report is {TEXT_REPORT_ID, number of chars, chars...}
+#define TEXT_REPORT_ID				2
+#define TEXT_REPORT_TIMEOUT_MS		2000
+
+// The feature report {LATENCY_REPORT_ID, 8 x uint16 LE} of the text interface
+// is the histogram of the RF arrival to USB IN token latency (see usbLatencyHist)
+#define LATENCY_REPORT_ID			3
+#define LATENCY_REPORT_SIZE			16
+
+// The feature report {HEALTH_REPORT_ID, ...} of the text interface is the last
+// heartbeat of the keyboard (rf_msg_heartbeat_t without the msg_type), then the
+// ms since the last packet and the seconds since the heartbeat, all little endian
+#define HEALTH_REPORT_ID			4
+#define HEALTH_REPORT_SIZE			14
 
 void reset_keyboard_report(void);
 void process_key_state_msg(__xdata const uint8_t* recv_buffer, const uint8_t bytes_received);
+
 void process_text_msg(__xdata const uint8_t* recv_buffer, const uint8_t bytes_received);
 
+// the link supervision (see LINK_TIMEOUT_MS); call link_heard() on every packet,
+// and link_check() with the ms since the last call. link_check() returns true if
+// it has released the keys, and the reports have to go out.
+void link_heard(void);
+bool link_check(uint8_t elapsed_ms);
+
+// the keyboard's health; the reports are read by the host through the
+// feature report HEALTH_REPORT_ID on the nRF24LU1 dongle
+void process_heartbeat_msg(__xdata const uint8_t* recv_buffer, const uint8_t bytes_received);
+
+extern __xdata rf_msg_heartbeat_t keyboard_health;	// the last heartbeat
+extern uint16_t heartbeat_age_sec;		// 0xffff if there was none yet
+extern uint16_t link_silent_ms;			// since the last packet of any kind
+
 // this is the HID report structure
 // this is what the data that we send to the host is comprised of
 typedef struct
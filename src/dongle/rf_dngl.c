@@ -65,9 +65,12 @@ void rf_dngl_init(void)
 	nRF_CE_hi();		// start receiving
 }
 
-uint8_t rf_dngl_recv(__xdata void* buff, uint8_t buff_size)
+__xdata const uint8_t* rf_dngl_recv_direct(uint8_t* bytes_received)
 {
-	uint8_t ret_val = 0;
+	__xdata const uint8_t* ret_val = NULL;
+	uint8_t width;
+	
+	*bytes_received = 0;
 	
 	// check if there's data in the RX FIFO
 	nRF_ReadReg(FIFO_STATUS);
@@ -75,30 +78,42 @@ uint8_t rf_dngl_recv(__xdata void* buff, uint8_t buff_size)
 	{
 		LED_on();
 		
-		// read the payload
 		nRF_ReadRxPayloadWidth();
-		ret_val = nRF_data[1];
+		width = nRF_data[1];
+
+		// reset the TX_DS; this has to be done before reading the payload,
+		// because every command overwrites the start of nRF_data
+		if (nRF_data[0] & vTX_DS)
+			nRF_WriteReg(STATUS, vTX_DS);
 
 		// the nRF specs state I have to drop the packet if the length is > 32
-		if (ret_val > 32)
+		if (width > 32)
 		{
 			nRF_FlushRX();
-			ret_val = 0;
 		} else {
-			nRF_ReadRxPayload(ret_val);
-			memcpy_X(buff, nRF_data + 1, ret_val > buff_size ? buff_size : ret_val);
+			// the payload stays where the driver clocked it in
+			nRF_ReadRxPayload(width);
+			ret_val = (__xdata const uint8_t*) nRF_data + 1;
+			*bytes_received = width;
 		}
 
-		// reset the TX_DS
-		if (nRF_data[0] & vTX_DS)
-			nRF_WriteReg(STATUS, vTX_DS);
-
 		LED_off();
 	}
 	
 	return ret_val;
 }
 
+uint8_t rf_dngl_recv(__xdata void* buff, uint8_t buff_size)
+{
+	uint8_t ret_val;
+	__xdata const uint8_t* payload = rf_dngl_recv_direct(&ret_val);
+	
+	if (payload)
+		memcpy_X(buff, payload, ret_val > buff_size ? buff_size : ret_val);
+
+	return ret_val;
+}
+
 void rf_dngl_queue_ack_payload(__xdata void* buff, const uint8_t num_bytes)
 {
 	// get the TX FIFO status
@@ -111,3 +126,14 @@ void rf_dngl_queue_ack_payload(__xdata void* buff, const uint8_t num_bytes)
 	// send the payload
 	nRF_WriteAckPayload(buff, num_bytes, 0);	// pipe 0
 }
+
+bool rf_dngl_queue_ack_payload_if_free(__xdata void* buff, const uint8_t num_bytes)
+{
+	nRF_ReadReg(FIFO_STATUS);
+	if (!(nRF_data[1]  &  vTX_EMPTY))
+		return false;
+
+	nRF_WriteAckPayload(buff, num_bytes, 0);	// pipe 0
+
+	return true;
+}
@@ -3,4 +3,12 @@
 void rf_dngl_init(void);
 uint8_t rf_dngl_recv(__xdata void* buff, uint8_t buff_size);
 
-void rf_dngl_queue_ack_payload(__xdata void* buff, uint8_t num_bytes);
\ No newline at end of file
+// returns the received payload without copying it, or NULL if there's nothing
+// the payload is in the driver's buffer, and it's valid until the next nRF call
+__xdata const uint8_t* rf_dngl_recv_direct(uint8_t* bytes_received);
+
+void rf_dngl_queue_ack_payload(__xdata void* buff, uint8_t num_bytes);
+
+// queues the payload only if there's no other payload waiting, so it doesn't
+// replace anything more important; returns false if it wasn't queued
+bool rf_dngl_queue_ack_payload_if_free(__xdata void* buff, uint8_t num_bytes);
\ No newline at end of file
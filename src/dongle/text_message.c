@@ -1,57 +1,149 @@
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 
+#include "tgtdefs.h"
 #include "keycode.h"
 #include "text_message.h"
-#include "tgtdefs.h"
+#include "text_dict.h"
 
-#define TEXT_MSG_BUFF_SIZE	128
+#if (TEXT_MSG_BUFF_SIZE & (TEXT_MSG_BUFF_SIZE - 1)) != 0
+# error TEXT_MSG_BUFF_SIZE has to be a power of two
+#endif
 
+#define TEXT_MSG_BUFF_MASK	(TEXT_MSG_BUFF_SIZE - 1)
+
+// head and tail are free running counters; they are masked only when indexing
+// the buffer, so head - tail is always the number of chars in the buffer
+// and we can use the entire buffer without sacrificing a slot
 __xdata char text_msg_buff[TEXT_MSG_BUFF_SIZE];
-__xdata uint8_t text_buff_head = 0;
-__xdata uint8_t text_buff_tail = 0;
+__xdata uint16_t text_buff_head = 0;
+__xdata uint16_t text_buff_tail = 0;
+__xdata uint16_t text_buff_high_water = 0;
 
-uint8_t msg_capacity(void)
+uint16_t msg_capacity(void)
 {
-	return TEXT_MSG_BUFF_SIZE - 1;
+	return TEXT_MSG_BUFF_SIZE;
 }
 
-uint8_t msg_size(void)
+uint16_t msg_size(void)
 {
-	if (text_buff_head < text_buff_tail)
-		return TEXT_MSG_BUFF_SIZE + text_buff_head - text_buff_tail;
-	
 	return text_buff_head - text_buff_tail;
 }
 
-uint8_t msg_free(void)
+uint16_t msg_free(void)
+{
+	return TEXT_MSG_BUFF_SIZE - msg_size();
+}
+
+uint16_t msg_high_water(void)
 {
-	return TEXT_MSG_BUFF_SIZE - msg_size() - 1;
+	return text_buff_high_water;
+}
+
+static void update_high_water(void)
+{
+	uint16_t size = msg_size();
+	if (size > text_buff_high_water)
+		text_buff_high_water = size;
 }
 
 void msg_push(char c)
 {
-	text_msg_buff[text_buff_head] = c;
-	text_buff_head = (text_buff_head + 1) % TEXT_MSG_BUFF_SIZE;
+	text_msg_buff[text_buff_head & TEXT_MSG_BUFF_MASK] = c;
+	++text_buff_head;
+
+	update_high_water();
+}
+
+void msg_push_block(__xdata const char* src, uint8_t len)
+{
+	// copy in at most two blocks: up to the end of the buffer, then the wrapped rest
+	uint16_t ndx = text_buff_head & TEXT_MSG_BUFF_MASK;
+	uint16_t first = TEXT_MSG_BUFF_SIZE - ndx;
+
+	if (first > len)
+		first = len;
+
+	memcpy_X(text_msg_buff + ndx, src, first);
+	if (len > first)
+		memcpy_X(text_msg_buff, src + first, len - first);
+
+	text_buff_head += len;
+
+	update_high_water();
+}
+
+void msg_push_text(__xdata const char* src, uint8_t len)
+{
+	uint8_t run, entry_len;
+	const __FLASH_ATTR char* entry;
+
+	// always leave room for the key-up at the end of the message
+	while (len  &&  msg_free() > 1)
+	{
+		// find the run of plain chars
+		run = 0;
+		while (run < len  &&  !IS_TEXT_DICT_TOKEN(src[run]))
+			++run;
+
+		if (run)
+		{
+			if (run > msg_free() - 1)
+				run = msg_free() - 1;
+
+			msg_push_block(src, run);
+			src += run;
+			len -= run;
+		} else {
+			// expand the dictionary token; unknown tokens are dropped
+			entry = text_dict_entry(*src, &entry_len);
+			if (entry)
+			{
+				while (entry_len--  &&  msg_free() > 1)
+					msg_push(*entry++);
+			}
+
+			++src;
+			--len;
+		}
+	}
 }
 
 char msg_pop(void)
 {
-	char ret_val = text_msg_buff[text_buff_tail];
-	text_buff_tail = (text_buff_tail + 1) % TEXT_MSG_BUFF_SIZE;
+	char ret_val = text_msg_buff[text_buff_tail & TEXT_MSG_BUFF_MASK];
+	++text_buff_tail;
 
 	return ret_val;
 }
 
+uint8_t msg_pop_text(__xdata char* dest, uint8_t max_len)
+{
+	uint8_t len = 0;
+	char c;
+
+	while (len < max_len  &&  !msg_empty())
+	{
+		c = msg_pop();
+
+		// the key-ups are only needed when typing the text
+		if (c)
+			dest[len++] = c;
+	}
+
+	return len;
+}
+
 char msg_peek(void)
 {
-	char ret_val = text_msg_buff[text_buff_tail];
+	char ret_val = text_msg_buff[text_buff_tail & TEXT_MSG_BUFF_MASK];
 	return ret_val;
 }
 
 bool msg_full(void)
 {
-	return ((text_buff_head + 1) % TEXT_MSG_BUFF_SIZE) == text_buff_tail;
+	return msg_size() == TEXT_MSG_BUFF_SIZE;
 }
 
 bool msg_empty(void)
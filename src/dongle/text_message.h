@@ -1,11 +1,27 @@
 #pragma once
 
+#include "tgtdefs.h"
+
+// the size of the text message ring buffer; has to be a power of two
+// we give it most of the RAM we don't use for anything else
+#ifndef TEXT_MSG_BUFF_SIZE
+# ifdef NRF24LU1
+#  define TEXT_MSG_BUFF_SIZE	1024		// 2KB of xdata on the nRF24LU1
+# else
+#  define TEXT_MSG_BUFF_SIZE	512			// 2KB of SRAM on the ATmega328p, V-USB needs some of it
+# endif
+#endif
+
 // contains a ring buffer implementation for the text messages
-uint8_t msg_size(void);
-uint8_t msg_free(void);
-uint8_t msg_capacity(void);
+uint16_t msg_size(void);
+uint16_t msg_free(void);
+uint16_t msg_capacity(void);
+uint16_t msg_high_water(void);		// the largest number of chars the buffer has held
 void msg_push(char c);
+void msg_push_block(__xdata const char* src, uint8_t len);	// caller has to check msg_free()
+void msg_push_text(__xdata const char* src, uint8_t len);	// expands dictionary tokens, stops when full
 char msg_pop(void);
+uint8_t msg_pop_text(__xdata char* dest, uint8_t max_len);		// pops up to max_len chars, skips the key-ups
 char msg_peek(void);
 bool msg_full(void);
 bool msg_empty(void);
@@ -20,11 +20,64 @@ usb_state_t	usb_state;
 __code const uint8_t* packetizer_data_ptr;
 uint8_t packetizer_data_size;
 
-// We are counting SOF packets as a timer for the HID idle rate.
+// We are counting SOF packets as a timer for the HID idle rate, one per interface.
 // usbframel & usbframeh are not good enough for this because of
 // difficulty accesing both LSB and MSB in a predictable manner
-uint16_t usbFrameCnt = 0;
-__xdata uint8_t usbHidIdle = 0;		// forever
+uint16_t usbFrameCnt[USB_NUM_HID_IDLE] = {0, 0};
+__xdata uint8_t usbHidIdle[USB_NUM_HID_IDLE] = {0, 0};		// 0 is forever
+
+// The frame timing. Timer0 runs free at CCLK/12; usbPoll() takes a timestamp
+// when it handles the SOF and the EP1 IN done. The EP1 IN comes right after the
+// host's IN token, so its distance from the SOF is where in the frame the host
+// polls. Both stamps are late by up to one main loop pass, so this is rough.
+#define TICKS_PER_FRAME			1333		// 16MHz/12 for 1ms
+#define TICKS_PER_US_X3			4			// 4 ticks are 3us
+
+// we arm in1buf this long before the IN token; more than the longest main loop pass
+#define STAGE_MARGIN_TICKS		200			// 150us
+
+#define IN_PHASE_MIN_SAMPLES	4
+
+uint16_t sofStamp;					// Timer0 at the last SOF
+uint8_t sofCount = 0;				// free running
+uint16_t inPhase;					// EWMA of the IN token's distance from the SOF, in ticks << 3
+uint8_t inPhaseSamples = 0;
+
+// the RF arrival of the last key state report; written by the main loop
+uint16_t arrivalStamp;
+uint8_t arrivalFrame;
+bool arrivalValid = false;
+uint16_t arrivalWaitUs = 0xffff;	// from the arrival to the next IN token
+
+// the arrival of the report in in1buf; written when arming and read when the report is taken
+uint16_t armedStamp;
+uint8_t armedFrame;
+bool armedValid = false;
+
+// the RF arrival to IN token latency, see USB_LATENCY_BINS
+__xdata uint16_t usbLatencyHist[USB_LATENCY_BINS] = {0, 0, 0, 0, 0, 0, 0, 0};
+
+// the upper limits of the bins in ticks: 250, 500, 750, 1000, 1500, 2000 and 4000us
+__code const uint16_t latency_bin_limits[USB_LATENCY_BINS - 1] =
+{
+	333, 667, 1000, 1333, 2000, 2667, 5333,
+};
+
+// reads the 16 bit Timer0 while it's running
+uint16_t timer0Read(void)
+{
+	uint8_t hi, lo;
+	
+	do {
+		hi = TH0;
+		lo = TL0;
+	} while (hi != TH0);
+
+	return ((uint16_t) hi << 8) | lo;
+}
+
+// the text reports are enabled while this is not 0; counts down on every SOF
+uint16_t usbTextFramesLeft = 0;
 
 void usbInit(void)
 {
@@ -61,31 +114,145 @@ void usbInit(void)
 	bin1addr = USB_EP0_SIZE/2;
 	bin2addr = bin1addr + USB_EP1_SIZE/2;
 	bin3addr = bin2addr + USB_EP2_SIZE/2;
-	bin4addr = bin3addr + 0;
+	bin4addr = bin3addr + USB_EP3_SIZE/2;
 	bin5addr = bin4addr + 0;
 
 	// enable endpoints
-	inbulkval = 0x07;	// enables IN endpoints on EP0, EP1 and EP2
+	inbulkval = 0x0f;	// enables IN endpoints on EP0, EP1, EP2 and EP3
 	outbulkval = 0x01;	// enables OUT endpoints on EP0
 	inisoval = 0x00;	// ISO not used
 	outisoval = 0x00;	// ISO not used
+
+	// Timer0 is the frame timer: 16 bit, free running
+	TMOD = (TMOD & 0xf0) | 0x01;
+	TR0 = 1;
 }
 
-bool usbHasIdleElapsed(void)
+bool usbHasIdleElapsed(uint8_t iface)
 {
 	bool retVal;
 	
-	if (usbHidIdle == 0)
+	if (usbHidIdle[iface] == 0)
 		return false;
 
-	retVal = usbFrameCnt >= usbHidIdle * 4;
-	
+	retVal = usbFrameCnt[iface] >= usbHidIdle[iface] * 4;
 	if (retVal)
-		usbFrameCnt = 0;
-	
+		usbFrameCnt[iface] = 0;
+
 	return retVal;
 }
 
+// returns the Timer0 ticks from now to the host's next IN token, or 0xffff if we don't know
+uint16_t ticksUntilIn(void)
+{
+	uint16_t phase, in_phase;
+	uint8_t samples;
+	
+	phase = timer0Read() - sofStamp;
+	in_phase = inPhase >> 3;
+	samples = inPhaseSamples;
+
+	// we don't know when the host polls yet
+	if (samples < IN_PHASE_MIN_SAMPLES)
+		return 0xffff;
+
+	// the SOF is late, or we are suspended
+	if (phase >= TICKS_PER_FRAME)
+		return 0xffff;
+
+	if (in_phase >= phase)
+		return in_phase - phase;
+
+	return in_phase + TICKS_PER_FRAME - phase;
+}
+
+void usbReportArrived(void)
+{
+	uint16_t until_in = ticksUntilIn();
+
+	arrivalStamp = timer0Read();
+	arrivalFrame = sofCount;
+	arrivalValid = true;
+	arrivalWaitUs = until_in == 0xffff ? 0xffff : until_in * 3 / TICKS_PER_US_X3;
+}
+
+uint8_t usbGetFrameCount(void)
+{
+	return sofCount;
+}
+
+uint16_t usbGetArrivalWaitUs(void)
+{
+	return arrivalWaitUs;
+}
+
+bool usbShouldStageReport(void)
+{
+	uint16_t until_in = ticksUntilIn();
+
+	return until_in == 0xffff  ||  until_in <= STAGE_MARGIN_TICKS;
+}
+
+void usbReportArmed(uint8_t iface)
+{
+	// the idle period starts over with every report
+	usbFrameCnt[iface] = 0;
+
+	if (iface == 0  &&  arrivalValid)
+	{
+		armedStamp = arrivalStamp;
+		armedFrame = arrivalFrame;
+		armedValid = true;
+		arrivalValid = false;
+	}
+}
+
+// called from usbPoll() when the host has taken the EP1 IN report
+void usbEp1InDone(void)
+{
+	uint16_t now = timer0Read();
+	uint16_t phase = now - sofStamp;
+	uint16_t latency;
+	uint8_t bin;
+
+	// the IN token's position in the frame
+	if (phase < TICKS_PER_FRAME)
+	{
+		if (inPhaseSamples < IN_PHASE_MIN_SAMPLES)
+		{
+			inPhase = phase << 3;
+			++inPhaseSamples;
+		} else {
+			inPhase += phase - (inPhase >> 3);
+		}
+	}
+
+	if (!armedValid)
+		return;
+
+	armedValid = false;
+
+	// Timer0 wraps every ~49ms; anything that old goes into the last bin
+	if ((uint8_t)(sofCount - armedFrame) >= 40)
+		latency = 0xffff;
+	else
+		latency = now - armedStamp;
+
+	for (bin = 0; bin < USB_LATENCY_BINS - 1; ++bin)
+	{
+		if (latency < latency_bin_limits[bin])
+			break;
+	}
+
+	if (usbLatencyHist[bin] != 0xffff)
+		++usbLatencyHist[bin];
+}
+
+bool usbTextReportsEnabled(void)
+{
+	return usbTextFramesLeft != 0;
+}
+
 void packetizer_isr_ep0_in(void)
 {
 	uint8_t size, i;
@@ -152,6 +319,9 @@ void usbGetDescriptor(void)
 		{
 			packetizer_data_ptr = usb_keyboard_report_descriptor;
 			packetizer_data_size = MIN(usbReqGetDesc.lengthLSB, USB_KBD_HID_REPORT_DESC_SIZE);
+		} else if (usbReqHidGetDesc.interface == 2) {
+			packetizer_data_ptr = usb_text_report_descriptor;
+			packetizer_data_size = MIN(usbReqGetDesc.lengthLSB, USB_TEXT_HID_REPORT_DESC_SIZE);
 		} else {
 			packetizer_data_ptr = usb_consumer_report_descriptor;
 			packetizer_data_size = MIN(usbReqGetDesc.lengthLSB, USB_CONS_HID_REPORT_DESC_SIZE);
@@ -242,6 +412,8 @@ void usbStdEndpointRequest(void)
 				in0buf[0] = in1cs & 0x01;
 			else if (endpoint == 0x82)
 				in0buf[0] = in2cs & 0x01;
+			else if (endpoint == 0x83)
+				in0buf[0] = in3cs & 0x01;
 			else if (endpoint == 0x01)
 				in0buf[0] = out1cs & 0x01;
 
@@ -287,6 +459,48 @@ void usbHidRequest(void)
 		// this requests the HID report we defined with the HID report descriptor.
 		// this is usually sent over EP1 IN, but can be sent over EP0 too.
 
+		if (usbRequest.wIndexLSB == 2  &&  usbRequest.wValueLSB == LATENCY_REPORT_ID)
+		{
+			uint8_t bin;
+			
+			// the latency histogram, little endian
+			in0buf[0] = LATENCY_REPORT_ID;
+			for (bin = 0; bin < USB_LATENCY_BINS; ++bin)
+			{
+				in0buf[1 + bin * 2] = usbLatencyHist[bin] & 0xff;
+				in0buf[2 + bin * 2] = usbLatencyHist[bin] >> 8;
+			}
+			in0bc = 1 + USB_LATENCY_BINS * 2;
+			return;
+		}
+
+		if (usbRequest.wIndexLSB == 2  &&  usbRequest.wValueLSB == HEALTH_REPORT_ID)
+		{
+			// the heartbeat is in the RF byte order, which is little endian too
+			__xdata const uint8_t* health = (__xdata const uint8_t*) &keyboard_health;
+			uint8_t cnt;
+
+			in0buf[0] = HEALTH_REPORT_ID;
+			for (cnt = 1; cnt < sizeof keyboard_health; ++cnt)
+				in0buf[cnt] = health[cnt];
+
+			in0buf[cnt++] = link_silent_ms & 0xff;
+			in0buf[cnt++] = link_silent_ms >> 8;
+			in0buf[cnt++] = heartbeat_age_sec & 0xff;
+			in0buf[cnt++] = heartbeat_age_sec >> 8;
+			in0bc = cnt;
+			return;
+		}
+
+		if (usbRequest.wIndexLSB == 2)
+		{
+			// the text interface; we don't have any text to give through EP0
+			in0buf[0] = TEXT_REPORT_ID;
+			in0buf[1] = 0;
+			in0bc = 2;
+			return;
+		}
+
 		in0buf[0] = usb_keyboard_report.modifiers;
 		in0buf[1] = 0;
 		in0buf[2] = usb_keyboard_report.keys[0];
@@ -301,17 +515,19 @@ void usbHidRequest(void)
 		
 	} else if (bRequest == USB_REQ_HID_GET_IDLE) {
 
-		in0buf[0] = usbHidIdle;
+		in0buf[0] = usbRequest.wIndexLSB < USB_NUM_HID_IDLE ? usbHidIdle[usbRequest.wIndexLSB] : 0;
 		in0bc = 0x01;
 	
 	} else if (bRequest == USB_REQ_HID_SET_IDLE) {
 
-		usbHidIdle = usbRequest.wValueMSB;
-		
+		// wIndexLSB is the interface, each has its own idle rate
 		// wValueLSB holds the reportID for which this rate applies,
-		// but we only have one, so this does not concern us
-
-		usbFrameCnt = 0;	// reset idle counter
+		// but we only have one per interface, so this does not concern us
+		if (usbRequest.wIndexLSB < USB_NUM_HID_IDLE)
+		{
+			usbHidIdle[usbRequest.wIndexLSB] = usbRequest.wValueMSB;
+			usbFrameCnt[usbRequest.wIndexLSB] = 0;	// reset idle counter
+		}
 
 		// send an empty packet and ACK the request
 		in0bc = 0x00;
@@ -353,8 +569,14 @@ void usbRequestReceived(void)
 
 void usbRequestDataReceived(void)
 {
-	if (usbRequest.bRequest == USB_REQ_HID_SET_REPORT)
+	if (usbRequest.bRequest == USB_REQ_HID_SET_REPORT  &&  usbRequest.wIndexLSB == 2)
 	{
+		// the host tool enables or disables the text reports
+		if (out0buf[0] == TEXT_REPORT_ID)
+		{
+			usbTextFramesLeft = out0buf[1] ? TEXT_REPORT_TIMEOUT_MS : 0;
+
+	} else if (usbRequest.bRequest == USB_REQ_HID_SET_REPORT) {
 		__xdata rf_msg_led_status_t msg;
 		
 		usb_led_report = out0buf[0];
@@ -396,7 +618,20 @@ void usbPoll(void)
 		break;
 	case INT_SOF:		// SOF packet
 		usbirq = 0x02;	// clear interrupt flag
-		++usbFrameCnt;
+		
+		sofStamp = timer0Read();
+		++sofCount;
+		
+		{
+			uint8_t iface;
+			for (iface = 0; iface < USB_NUM_HID_IDLE; ++iface)
+			{
+				++usbFrameCnt[iface];
+			}
+		}
+		
+		if (usbTextFramesLeft)
+			--usbTextFramesLeft;
 		break;
 	/*
 	case INT_SUTOK:		// setup token
@@ -410,6 +645,7 @@ void usbPoll(void)
 		usbirq = 0x10;	// clear interrupt flag
 		usb_state = DEFAULT;	// reset internal states
 		usb_current_config = 0;
+		inPhaseSamples = 0;		// the host might poll at a different time now
 		break;
 
 	case INT_EP0IN:
@@ -428,9 +664,13 @@ void usbPoll(void)
 
 	case INT_EP1IN:
 		in_irq = 0x02;
+		usbEp1InDone();
 		break;
 	case INT_EP2IN:
 		in_irq = 0x04;
 		break;
+	case INT_EP3IN:
+		in_irq = 0x08;
+		break;
 	}
 }
@@ -197,11 +197,16 @@ typedef struct
 	usb_if_desc_t	if2;
 	usb_hid_desc_t	hid2;
 	usb_ep_desc_t	ep2in;
+
+	usb_if_desc_t	if3;
+	usb_hid_desc_t	hid3;
+	usb_ep_desc_t	ep3in;
 } usb_conf_desc_keyboard_t;
 
 #define USB_STRING_DESC_COUNT			4
 #define USB_KBD_HID_REPORT_DESC_SIZE	0x3f
 #define USB_CONS_HID_REPORT_DESC_SIZE	0x2d
+#define USB_TEXT_HID_REPORT_DESC_SIZE	0x2d
 
 extern __code const usb_conf_desc_keyboard_t usb_conf_desc;
 extern __code const usb_dev_desc_t usb_dev_desc;
@@ -211,11 +216,45 @@ extern __code const uint16_t usb_string_desc_2[];
 extern __code const uint16_t usb_string_desc_3[];
 extern __code const uint8_t usb_keyboard_report_descriptor[USB_KBD_HID_REPORT_DESC_SIZE];
 extern __code const uint8_t usb_consumer_report_descriptor[USB_CONS_HID_REPORT_DESC_SIZE];
+extern __code const uint8_t usb_text_report_descriptor[USB_TEXT_HID_REPORT_DESC_SIZE];
 
 void usbInit(void);
 void usbPoll(void);
 
-bool usbHasIdleElapsed(void);
+// the HID idle rate is kept for the keyboard (0) and the consumer (1) interface
+#define USB_NUM_HID_IDLE	2
+
+// returns true once every idle period of the interface without a report
+bool usbHasIdleElapsed(uint8_t iface);
+
+// Frame synchronous report staging. The main loop keeps the newest keyboard
+// report and arms in1buf only just before the host's next IN token, which is
+// measured from the SOF. A report that comes in from the RF before that replaces
+// the older one instead of waiting for the next frame.
+
+// call when a key state message has been received
+void usbReportArrived(void);
+
+// the free running count of the SOFs; one per ms while the bus is not suspended
+uint8_t usbGetFrameCount(void);
+
+// returns true if in1buf should be armed now
+bool usbShouldStageReport(void);
+
+// the time from the arrival of the last key state report to the IN token that
+// takes it in us, or 0xffff if we don't know when the host polls
+uint16_t usbGetArrivalWaitUs(void);
+
+// call after arming the endpoint of the interface
+void usbReportArmed(uint8_t iface);
+
+// the histogram of the times from the RF arrival to the host taking the report
+// the bins end at 250, 500, 750, 1000, 1500, 2000, 4000us and the last is the rest
+#define USB_LATENCY_BINS	8
+extern __xdata uint16_t usbLatencyHist[USB_LATENCY_BINS];
+
+// returns true if the host tool has enabled the text reports and keeps them enabled
+bool usbTextReportsEnabled(void);
 
 #define CAPS_LOCK_MASK		0x01
 #define NUM_LOCK_MASK		0x02
@@ -227,3 +266,4 @@ __xdata extern uint8_t usbIdleRate;				// in 4 ms units
 #define USB_EP0_SIZE	0x40
 #define USB_EP1_SIZE	0x08
 #define USB_EP2_SIZE	0x08
+#define USB_EP3_SIZE	0x40
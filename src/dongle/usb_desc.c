@@ -2,6 +2,7 @@
 #include <stdbool.h>
 
 #include "usb.h"
+#include "reports.h"
 
 __code const usb_dev_desc_t usb_dev_desc =
 {
@@ -87,6 +88,34 @@ __code const uint8_t usb_consumer_report_descriptor[USB_CONS_HID_REPORT_DESC_SIZ
 	0xc0				// End Collection
 };
 
+// vendor defined report used to send the text messages to the host tool
+// much faster than typing them as keystrokes
+__code const uint8_t usb_text_report_descriptor[USB_TEXT_HID_REPORT_DESC_SIZE] =
+{
+	0x06, 0x00, 0xff,	// USAGE_PAGE (Vendor Defined Page 1)
+	0x09, 0x01,			// USAGE (Vendor Usage 1)
+	0xa1, 0x01,			// COLLECTION (Application)
+	0x85, TEXT_REPORT_ID,	//		REPORT_ID (2)
+	0x15, 0x00,			//		LOGICAL_MINIMUM (0)
+	0x26, 0xff, 0x00,	//		LOGICAL_MAXIMUM (255)
+	0x75, 0x08,			//		REPORT_SIZE (8)
+	0x95, USB_EP3_SIZE - 1,	//		REPORT_COUNT (63)
+	0x09, 0x01,			//		USAGE (Vendor Usage 1)
+	0x81, 0x02,			//		INPUT (Data,Var,Abs)	- length byte followed by the text
+	0x95, 0x01,			//		REPORT_COUNT (1)
+	0x09, 0x01,			//		USAGE (Vendor Usage 1)
+	0x91, 0x02,			//		OUTPUT (Data,Var,Abs)	- enable/disable the text reports
+	0x85, LATENCY_REPORT_ID,	//		REPORT_ID (3)
+	0x95, LATENCY_REPORT_SIZE,	//		REPORT_COUNT (16)
+	0x09, 0x02,			//		USAGE (Vendor Usage 2)
+	0xb1, 0x02,			//		FEATURE (Data,Var,Abs)	- the latency histogram
+	0x85, HEALTH_REPORT_ID,		//		REPORT_ID (4)
+	0x95, HEALTH_REPORT_SIZE,	//		REPORT_COUNT (14)
+	0x09, 0x03,			//		USAGE (Vendor Usage 3)
+	0xb1, 0x02,			//		FEATURE (Data,Var,Abs)	- the keyboard's health
+	0xc0				// END_COLLECTION
+};
+
 __code const usb_conf_desc_keyboard_t usb_conf_desc = 
 {
 	// configuration descriptor
@@ -94,7 +123,7 @@ __code const usb_conf_desc_keyboard_t usb_conf_desc =
 		sizeof(usb_conf_desc_t),
 		USB_DESC_CONFIGURATION,
 		sizeof(usb_conf_desc_keyboard_t),
-		2,		// bNumInterfaces
+		3,		// bNumInterfaces
 		1,		// bConfigurationValue
 		2,		// iConfiguration
 		0x80,	// bmAttributes - bus powered, no remote wakeup
@@ -163,6 +192,38 @@ __code const usb_conf_desc_keyboard_t usb_conf_desc =
 		USB_EP_TYPE_INT,	// bmAttributes
 		USB_EP2_SIZE,		// wMaxPacketSize
 		10,					// bInterval		10ms
+	},
+
+	// text interface descriptor
+	{
+		sizeof(usb_if_desc_t),
+		USB_DESC_INTERFACE,
+		2,		// bInterfaceNumber
+		0,		// bAlternateSetting
+		1,		// bNumEndpoints
+		3,		// bInterfaceClass		- HID
+		0,		// bInterfaceSubClass
+		0,		// bInterfaceProtocol
+		0,		// iInterface
+	},
+	// HID descriptor
+	{
+		sizeof(usb_hid_desc_t),
+		USB_DESC_HID,
+		0x0111,					// bcdHID
+		0,						// bCountryCode
+		1,						// bNumDescriptors
+		USB_DESC_HID_REPORT,	// bDescriptorType_HID
+		sizeof(usb_text_report_descriptor),	// wDescriptorLength
+	},
+	// endpoint descriptor EP3IN
+	{
+		sizeof(usb_ep_desc_t),
+		USB_DESC_ENDPOINT,
+		0x83,				// bEndpointAddress
+		USB_EP_TYPE_INT,	// bmAttributes
+		USB_EP3_SIZE,		// wMaxPacketSize
+		1,					// bInterval		1ms
 	}
 };
 
@@ -15,7 +15,7 @@
 // USB_REGS_EXTERN volatile __xdata __AT (0xC4C0) uint8_t out4buf[USB_EP_DEFAULT_BUF_SIZE];
 // USB_REGS_EXTERN volatile __xdata __AT (0xC500) uint8_t in4buf[USB_EP_DEFAULT_BUF_SIZE];
 // USB_REGS_EXTERN volatile __xdata __AT (0xC540) uint8_t out3buf[USB_EP_DEFAULT_BUF_SIZE];
-// USB_REGS_EXTERN volatile __xdata __AT (0xC580) uint8_t in3buf[USB_EP_DEFAULT_BUF_SIZE];
+USB_REGS_EXTERN volatile __xdata __AT (0xC580) uint8_t in3buf[USB_EP3_SIZE];
 // USB_REGS_EXTERN volatile __xdata __AT (0xC5C0) uint8_t out2buf[USB_EP_DEFAULT_BUF_SIZE];
 USB_REGS_EXTERN volatile __xdata __AT (0xC600) uint8_t in2buf[USB_EP2_SIZE];
 //USB_REGS_EXTERN volatile __xdata __AT (0xC640) uint8_t out1buf[USB_EP_DEFAULT_BUF_SIZE];
@@ -0,0 +1,299 @@
+// Reads the text messages (menu, stats) from the 7G wireless dongle through its
+// vendor defined HID report. While this runs the dongle does not type the text
+// into the focused window, so the menu is printed here almost instantly.
+//
+// usage: 7g_text [-l | -k] [/dev/hidrawN]
+//
+// -l prints the dongle's histogram of the latency from the RF packet arriving
+// to the host taking the USB report, and exits.
+// -k prints the keyboard's health from its last heartbeat, and exits.
+//
+// Without an argument it looks for the dongle on /dev/hidraw0 to /dev/hidraw63.
+// The user needs read and write access to the hidraw device (udev rule or sudo).
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/hidraw.h>
+
+// these have to match the dongle (see dongle/reports.h)
+#define TEXT_REPORT_ID				2
+#define TEXT_REPORT_TIMEOUT_MS		2000
+#define LATENCY_REPORT_ID			3
+#define LATENCY_BINS				8
+#define HEALTH_REPORT_ID			4
+#define HEALTH_REPORT_SIZE			14
+
+// we refresh the enable well within the dongle's timeout
+#define KEEP_ALIVE_MS				(TEXT_REPORT_TIMEOUT_MS / 4)
+
+#define MAX_REPORT_SIZE				64
+
+static volatile sig_atomic_t quit = 0;
+
+static void on_signal(int sig)
+{
+	(void) sig;
+	quit = 1;
+}
+
+// returns true if the report descriptor of the device has our vendor defined text report
+static bool has_text_report(int fd)
+{
+	struct hidraw_report_descriptor rdesc;
+	int desc_size = 0;
+	uint32_t ndx;
+
+	if (ioctl(fd, HIDIOCGRDESCSIZE, &desc_size) < 0)
+		return false;
+
+	rdesc.size = desc_size;
+	if (ioctl(fd, HIDIOCGRDESC, &rdesc) < 0)
+		return false;
+
+	// look for USAGE_PAGE (Vendor Defined Page 1) followed by REPORT_ID (TEXT_REPORT_ID)
+	for (ndx = 0; ndx + 2 < rdesc.size; ++ndx)
+	{
+		if (rdesc.value[ndx] == 0x06  &&  rdesc.value[ndx + 1] == 0x00  &&  rdesc.value[ndx + 2] == 0xff)
+		{
+			for (ndx += 3; ndx + 1 < rdesc.size; ++ndx)
+			{
+				if (rdesc.value[ndx] == 0x85  &&  rdesc.value[ndx + 1] == TEXT_REPORT_ID)
+					return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+static int open_dongle(const char* path)
+{
+	char name[32];
+	int fd, cnt;
+
+	if (path)
+	{
+		fd = open(path, O_RDWR);
+		if (fd < 0)
+		{
+			perror(path);
+		} else if (!has_text_report(fd)) {
+			fprintf(stderr, "%s is not a 7G dongle with the text report\n", path);
+			close(fd);
+			fd = -1;
+		}
+
+		return fd;
+	}
+
+	for (cnt = 0; cnt < 64; ++cnt)
+	{
+		snprintf(name, sizeof name, "/dev/hidraw%d", cnt);
+		fd = open(name, O_RDWR);
+		if (fd < 0)
+			continue;
+
+		if (has_text_report(fd))
+		{
+			fprintf(stderr, "using %s\n", name);
+			return fd;
+		}
+
+		close(fd);
+	}
+
+	fprintf(stderr, "7G dongle not found\n");
+
+	return -1;
+}
+
+// enables or disables the text report on the dongle
+static bool set_text_report(int fd, bool enable)
+{
+	uint8_t report[2] = {TEXT_REPORT_ID, enable ? 1 : 0};
+
+	return write(fd, report, sizeof report) == sizeof report;
+}
+
+// prints the RF to USB latency histogram from the feature report
+static bool print_latency(int fd)
+{
+	static const char* const bin_names[LATENCY_BINS] =
+	{
+		"< 250us", "< 500us", "< 750us", "< 1ms", "< 1.5ms", "< 2ms", "< 4ms", ">= 4ms",
+	};
+
+	uint8_t report[1 + LATENCY_BINS * 2] = {LATENCY_REPORT_ID};
+	uint32_t counts[LATENCY_BINS], total = 0;
+	int bin;
+
+	if (ioctl(fd, HIDIOCGFEATURE(sizeof report), report) < (int) sizeof report)
+	{
+		perror("reading the latency report");
+		return false;
+	}
+
+	for (bin = 0; bin < LATENCY_BINS; ++bin)
+	{
+		counts[bin] = report[1 + bin * 2] | (report[2 + bin * 2] << 8);
+		total += counts[bin];
+	}
+
+	printf("RF to USB latency, %u key state reports\n", total);
+	for (bin = 0; bin < LATENCY_BINS; ++bin)
+		printf("%8s %8u %5.1f%%\n", bin_names[bin], counts[bin], total ? counts[bin] * 100.0 / total : 0.0);
+
+	return true;
+}
+
+// prints the keyboard's health from the feature report
+static bool print_health(int fd)
+{
+	static const char* const level_names[] = {"ok", "low", "critical"};
+
+	uint8_t report[1 + HEALTH_REPORT_SIZE] = {HEALTH_REPORT_ID};
+
+	if (ioctl(fd, HIDIOCGFEATURE(sizeof report), report) < (int) sizeof report)
+	{
+		perror("reading the health report");
+		return false;
+	}
+
+	// the rf_msg_heartbeat_t without the msg_type, then the ages
+	uint16_t voltage = report[1] | (report[2] << 8);
+	uint8_t level = report[3];
+	uint16_t packets = report[4] | (report[5] << 8);
+	uint16_t lost = report[6] | (report[7] << 8);
+	uint16_t retransmits = report[8] | (report[9] << 8);
+	uint8_t link_losses = report[10];
+	uint16_t silent_ms = report[11] | (report[12] << 8);
+	uint16_t age_sec = report[13] | (report[14] << 8);
+
+	if (age_sec == 0xffff)
+	{
+		printf("no heartbeat from the keyboard yet (enable it in the menu with F9)\n");
+		return true;
+	}
+
+	printf("last heartbeat   %us ago\n", age_sec);
+	printf("last packet      %s%ums ago\n", silent_ms == 0xffff ? ">= " : "", silent_ms);
+	printf("battery          %u.%02uV, %s\n", voltage / 100, voltage % 100,
+			level < sizeof level_names / sizeof level_names[0] ? level_names[level] : "?");
+	printf("packets          %u (the low 16 bits)\n", packets);
+	printf("lost packets     %u\n", lost);
+	printf("retransmits      %u\n", retransmits);
+	printf("link losses      %u\n", link_losses);
+
+	return true;
+}
+
+static uint64_t get_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void print_text(const uint8_t* text, int len)
+{
+	int ndx;
+
+	for (ndx = 0; ndx < len; ++ndx)
+	{
+		if (text[ndx] == 0x01)			// Ctrl-A: the menu starts over
+			fputs(isatty(STDOUT_FILENO) ? "\033[2J\033[H" : "\n", stdout);
+		else if (text[ndx] == '\n'  ||  (text[ndx] >= ' '  &&  text[ndx] < 0x7f))
+			putchar(text[ndx]);
+	}
+
+	fflush(stdout);
+}
+
+int main(int argc, char* argv[])
+{
+	uint8_t report[MAX_REPORT_SIZE];
+	struct pollfd pfd;
+	uint64_t last_enable = 0;
+	bool latency = false, health = false;
+	int fd, bytes;
+
+	if (argc > 1  &&  strcmp(argv[1], "-l") == 0)
+	{
+		latency = true;
+		--argc;
+		++argv;
+	} else if (argc > 1  &&  strcmp(argv[1], "-k") == 0) {
+		health = true;
+		--argc;
+		++argv;
+	}
+
+	fd = open_dongle(argc > 1 ? argv[1] : NULL);
+	if (fd < 0)
+		return EXIT_FAILURE;
+
+	if (latency)
+	{
+		bool ok = print_latency(fd);
+		close(fd);
+		return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (health)
+	{
+		bool ok = print_health(fd);
+		close(fd);
+		return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	while (!quit)
+	{
+		if (get_ms() - last_enable >= KEEP_ALIVE_MS)
+		{
+			if (!set_text_report(fd, true))
+			{
+				perror("enabling the text report");
+				break;
+			}
+
+			last_enable = get_ms();
+		}
+
+		// wait for the text; wake up in time to refresh the enable
+		if (poll(&pfd, 1, KEEP_ALIVE_MS) <= 0)
+			continue;
+
+		bytes = read(fd, report, sizeof report);
+		if (bytes < 0)
+		{
+			perror("read");
+			break;
+		}
+
+		// {TEXT_REPORT_ID, number of chars, chars...}
+		if (bytes >= 2  &&  report[0] == TEXT_REPORT_ID  &&  report[1] <= bytes - 2)
+			print_text(report + 2, report[1]);
+	}
+
+	// the dongle goes back to typing the text
+	set_text_report(fd, false);
+	close(fd);
+
+	return EXIT_SUCCESS;
+}
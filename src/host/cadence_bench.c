@@ -0,0 +1,246 @@
+// Replays key press timestamps against the keyboard's scan scheduling and
+// compares the fixed sleep schedule with the typing cadence predictor
+// (keyb_ctrl/cadence.c). It reports the wake-ups (matrix scans) per minute and
+// the percentiles of the latency the scanning adds to the key presses.
+//
+// usage: cadence_bench [timestamps_file]
+//
+// The file has one key press per line: the time of the press in milliseconds,
+// optionally followed by the time the key was held down in milliseconds.
+// Without a file a synthetic hour of typing is generated (words, sentences,
+// short and long pauses) with a fixed seed, so the runs are repeatable.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cadence.h"
+
+#define TICKS_PER_SEC		4096.0		// Timer2 ticks of 244.14us
+#define DEFAULT_HOLD_MS		90
+
+typedef struct
+{
+	double	press;		// in ticks
+	double	release;
+} keystroke_t;
+
+keystroke_t* keys = NULL;
+int num_keys = 0;
+int keys_size = 0;
+
+// this has to match sleep_schedule_balanced in keyb_ctrl/sleeping.c
+typedef struct
+{
+	uint16_t	duration_sec;
+	uint8_t		num_ticks;
+} sleep_schedule_period_t;
+
+const sleep_schedule_period_t sleep_schedule[] =
+{
+	{   300,   24},
+	{   900,   33},
+	{  1800,   82},
+	{0xffff,  250},
+};
+
+void add_key(double press_ms, double hold_ms)
+{
+	if (num_keys == keys_size)
+	{
+		keys_size = keys_size ? keys_size * 2 : 1024;
+		keys = realloc(keys, keys_size * sizeof *keys);
+		if (keys == NULL)
+		{
+			perror("realloc");
+			exit(1);
+		}
+	}
+
+	keys[num_keys].press = press_ms * TICKS_PER_SEC / 1000;
+	keys[num_keys].release = (press_ms + hold_ms) * TICKS_PER_SEC / 1000;
+	++num_keys;
+}
+
+bool read_keys(const char* file_name)
+{
+	FILE* f = fopen(file_name, "r");
+	if (f == NULL)
+	{
+		perror(file_name);
+		return false;
+	}
+
+	char line[128];
+	double press_ms, hold_ms;
+	while (fgets(line, sizeof line, f))
+	{
+		int fields = sscanf(line, "%lf %lf", &press_ms, &hold_ms);
+		if (fields < 1)
+			continue;
+
+		add_key(press_ms, fields == 2 ? hold_ms : DEFAULT_HOLD_MS);
+	}
+
+	fclose(f);
+
+	return true;
+}
+
+// a small LCG so the synthetic trace is the same everywhere
+uint32_t rnd_state = 12345;
+
+double rnd(double min, double max)
+{
+	rnd_state = rnd_state * 1103515245 + 12345;
+	return min + (max - min) * ((rnd_state >> 8) & 0xffff) / 65536.0;
+}
+
+void make_synthetic_keys(double duration_ms)
+{
+	double t = 1000;
+	int words = 0, sentences = 0;
+	while (t < duration_ms)
+	{
+		// a word
+		int chars = (int) rnd(2, 9);
+		while (chars--)
+		{
+			add_key(t, rnd(70, 130));
+			t += rnd(90, 300);
+		}
+
+		// the space
+		add_key(t, rnd(70, 130));
+		t += rnd(120, 450);
+
+		// the end of a sentence: think a bit
+		if (++words % 12 == 0)
+		{
+			t += rnd(1000, 4000);
+
+			// every few sentences go for a coffee
+			if (++sentences % 5 == 0)
+				t += rnd(20000, 300000);
+		}
+	}
+}
+
+uint8_t schedule_ticks(double since_reset)
+{
+	double sec = since_reset / TICKS_PER_SEC;
+	const sleep_schedule_period_t* period = sleep_schedule;
+	while (period->duration_sec != 0xffff  &&  sec >= period->duration_sec)
+	{
+		sec -= period->duration_sec;
+		++period;
+	}
+
+	return period->num_ticks;
+}
+
+int cmp_double(const void* a, const void* b)
+{
+	double da = *(const double*) a, db = *(const double*) b;
+	return da < db ? -1 : da > db;
+}
+
+double percentile(const double* sorted, int num, double pct)
+{
+	int ndx = (int)(pct / 100 * (num - 1) + 0.5);
+	return sorted[ndx];
+}
+
+void simulate(const char* name, bool use_cadence)
+{
+	double* latencies = malloc(num_keys * sizeof *latencies);
+	int num_latencies = 0;
+
+	// we start with the state of the cadence.c globals after reset
+	double t = 0, reset_time = 0, end = keys[num_keys - 1].release + TICKS_PER_SEC;
+	uint32_t scans = 0;
+	int first_key = 0;				// the first key that's not released yet
+	int next_press = 0;				// the first key not detected yet
+	uint8_t prev_pressed = 0;
+	while (t < end)
+	{
+		++scans;
+
+		// what does the matrix look like now?
+		while (first_key < num_keys  &&  keys[first_key].release <= t)
+			++first_key;
+
+		uint8_t pressed = 0;
+		int k;
+		for (k = first_key; k < num_keys  &&  keys[k].press <= t; ++k)
+			if (keys[k].release > t)
+				++pressed;
+
+		// the presses since the previous scan are detected now
+		bool changed = pressed != prev_pressed;
+		while (next_press < num_keys  &&  keys[next_press].press <= t)
+		{
+			latencies[num_latencies++] = t - keys[next_press].press;
+			changed = true;
+			++next_press;
+		}
+
+		// every change starts a new wait_for_*() which resets the sleep schedule
+		if (changed)
+		{
+			reset_time = t;
+			if (use_cadence)
+				cadence_key_event((uint32_t) t, pressed);
+		}
+
+		prev_pressed = pressed;
+
+		uint8_t ticks = schedule_ticks(t - reset_time);
+		if (use_cadence)
+			ticks = cadence_next_ticks((uint32_t) t, sleep_schedule[0].num_ticks, ticks);
+
+		t += ticks;
+	}
+
+	qsort(latencies, num_latencies, sizeof *latencies, cmp_double);
+
+	double to_ms = 1000 / TICKS_PER_SEC;
+	printf("%-10s %10.1f %8.2f %8.2f %8.2f %8.2f\n", name,
+			scans / (end / TICKS_PER_SEC / 60),
+			percentile(latencies, num_latencies, 50) * to_ms,
+			percentile(latencies, num_latencies, 90) * to_ms,
+			percentile(latencies, num_latencies, 99) * to_ms,
+			latencies[num_latencies - 1] * to_ms);
+
+	free(latencies);
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc > 1)
+	{
+		if (!read_keys(argv[1]))
+			return 1;
+	} else {
+		make_synthetic_keys(3600 * 1000.0);
+	}
+
+	if (num_keys == 0)
+	{
+		fprintf(stderr, "no key presses\n");
+		return 1;
+	}
+
+	printf("%d key presses in %.1f minutes%s\n\n", num_keys,
+			keys[num_keys - 1].press / TICKS_PER_SEC / 60, argc > 1 ? "" : " (synthetic)");
+	printf("%-10s %10s %8s %8s %8s %8s\n", "", "scans/min", "p50 ms", "p90 ms", "p99 ms", "max ms");
+
+	simulate("fixed", false);
+	simulate("cadence", true);
+
+	free(keys);
+
+	return 0;
+}
@@ -0,0 +1,123 @@
+// Checks the charge model of the keyboard (keyb_ctrl/energy.c) against the same
+// datasheet currents calculated in floating point, and the counting of the fast
+// clock time with a stub watch.
+//
+// usage: energy_test
+//
+// Prints the failed checks; the exit code is the number of failures.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "energy.h"
+
+#define TICKS_PER_SEC		4096.0
+#define FRAMES_PER_SEC		128.0
+
+// the currents in energy.c, in uA
+#define SLEEP_UA			7.0
+#define AWAKE_UA			400.0
+#define FAST_UA				1700.0
+#define NRF_UP_UA			26.0
+#define NRF_START_UC		0.6
+#define LED_UA				5000.0
+#define TX_0DBM_UC			6.8
+
+// the stub watch
+uint32_t stub_seconds = 0;
+uint32_t stub_ticks = 0;
+
+uint32_t get_seconds32(void)
+{
+	return stub_seconds;
+}
+
+uint32_t get_ticks(void)
+{
+	return stub_ticks;
+}
+
+int failures = 0;
+
+#define CHECK(cond)		check(cond, #cond, __LINE__)
+
+static void check(bool ok, const char* what, int line)
+{
+	if (!ok)
+	{
+		printf("line %d: %s\n", line, what);
+		++failures;
+	}
+}
+
+// true if the model is within 1% and 1uAh of the floating point result
+static bool close_to(uint32_t uah, double expected)
+{
+	return fabs(uah - expected) <= expected / 100 + 1;
+}
+
+int main(void)
+{
+	double expected;
+
+	// a week: 1h awake of which 10min on the fast clock, 10min nRF on,
+	// 1000 nRF power ups, 200k TX attempts at 0dBm and 10min of one LED at full
+	stub_seconds = 7 * 24 * 3600;
+	energy_awake_ticks = 3600 * TICKS_PER_SEC;
+	energy_fast_ticks = 600 * TICKS_PER_SEC;
+	energy_nrf_ticks = 600 * TICKS_PER_SEC;
+	energy_nrf_power_ups = 1000;
+	energy_tx_attempts[3] = 200000;
+	energy_led_weighted = (uint32_t)(600 * FRAMES_PER_SEC) * 255;
+
+	expected = SLEEP_UA * 7 * 24
+				+ AWAKE_UA * 3000 / 3600
+				+ FAST_UA * 600 / 3600
+				+ NRF_UP_UA * 600 / 3600
+				+ NRF_START_UC * 1000 / 3600
+				+ TX_0DBM_UC * 200000 / 3600
+				+ LED_UA * 600 / 3600 * 255 / 256;
+
+	printf("a week: %u uAh, %.0f uAh expected\n", (unsigned) energy_get_used_uah(), expected);
+	CHECK(close_to(energy_get_used_uah(), expected));
+
+	// the fast clock adds to the awake charge
+	energy_fast_ticks = 0;
+	uint32_t without_fast = energy_get_used_uah();
+	energy_fast_ticks = 600 * TICKS_PER_SEC;
+	CHECK(close_to(energy_get_used_uah() - without_fast, (FAST_UA - AWAKE_UA) * 600 / 3600));
+
+	// the fast clock time between clock_fast() and clock_slow()
+	energy_fast_ticks = 0;
+	stub_ticks = 1000;
+	energy_clock_fast();
+	stub_ticks = 1010;
+	energy_clock_fast();		// already fast; the start stays
+	stub_ticks = 1025;
+	energy_clock_slow();
+	stub_ticks = 1100;
+	energy_clock_slow();		// already slow
+	CHECK(energy_fast_ticks == 25);
+
+	// a stale TCNT2 after a wake-up can make the start look later than the end
+	stub_ticks = 2000;
+	energy_clock_fast();
+	stub_ticks = 1990;
+	energy_clock_slow();
+	CHECK(energy_fast_ticks == 25);
+
+	// the battery life: 2000mAh, half of it used in 1000 hours
+	stub_seconds = 1000 * 3600;
+	energy_awake_ticks = energy_fast_ticks = energy_nrf_ticks = energy_nrf_power_ups = 0;
+	energy_led_weighted = 0;
+	energy_tx_attempts[3] = (1000000 - SLEEP_UA * 1000) * 3600 / TX_0DBM_UC;
+	printf("half used in 1000h: %u hours left\n", energy_get_hours_left());
+	CHECK(energy_get_hours_left() >= 990  &&  energy_get_hours_left() <= 1010);
+
+	if (failures == 0)
+		printf("all passed\n");
+
+	return failures;
+}
@@ -0,0 +1,176 @@
+// Simulates an RF outage that starts with a key press and compares the old
+// behaviour (45 attempts, then the keyboard locks) with the link recovery of
+// keyb_ctrl/link.c. It reports the time from the dongle coming back to the
+// keyboard being in sync again, and the charge drawn while the dongle is away.
+// The new behaviour is run twice: idle after the first key press, and with
+// a key press every PRESS_TICKS during the outage (each one is a new key state
+// and calls link_activity()).
+//
+// usage: link_bench
+//
+// The timings of the attempts and the charges follow keyb_ctrl/rf_ctrl.c and
+// keyb_ctrl/energy.c; the keyboard scans every SCAN_TICKS during the outage,
+// so a ping goes out on the first scan after it's due.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "link.h"
+
+#define TICKS_PER_SEC		4096.0		// Timer2 ticks of 244.14us
+#define SCAN_TICKS			24			// the balanced profile while typing
+#define PRESS_TICKS			1024		// 250ms between the key presses while typing
+
+// this has to match rf_ctrl.c
+#define OLD_ATTEMPTS		45
+#define LINK_LOSS_ATTEMPTS	12
+#define PROBE_ARC			3
+#define TICKS_INCREMENT		20
+
+// one transmission: TX settling, the packet and the ARD of 250us; ~450us
+#define TX_US				450.0
+
+// the charges in nC, from energy.c at 0dBm
+#define TX_NC				6800.0		// per transmission with the ARD
+#define NRF_START_NC		600.0		// the crystal start up
+#define AWAKE_NC_PER_TICK	98.0
+#define SLEEP_UA			7.0
+
+// the ticks an attempt of arc_max auto retransmits takes when nothing answers
+double attempt_ticks(int arc_max)
+{
+	return (1 + arc_max) * TX_US / 1e6 * TICKS_PER_SEC + 2;
+}
+
+double attempt_nc(int arc_max)
+{
+	return (1 + arc_max) * TX_NC + attempt_ticks(arc_max) * AWAKE_NC_PER_TICK;
+}
+
+// the retries of rf_ctrl_send_message(); returns the time of the ACK, or -1 if
+// there was none. *end is when it gave up, *charge is what it cost.
+double send_message(double t, int max_attempts, double dongle_back, double* end, double* charge)
+{
+	int attempts = 0;
+	uint8_t ticks = 15;
+	while (attempts < max_attempts)
+	{
+		if (t >= dongle_back)
+		{
+			*charge += TX_NC + 2 * AWAKE_NC_PER_TICK;
+			return t + 2;
+		}
+
+		*charge += attempt_nc(15);
+		t += attempt_ticks(15);
+
+		if (++attempts < max_attempts)
+		{
+			if (ticks >= 0xfe - TICKS_INCREMENT)
+			{
+				t += 5 * 255;
+			} else {
+				t += ticks;
+				ticks += TICKS_INCREMENT;
+			}
+		}
+	}
+
+	*end = t;
+	return -1;
+}
+
+// returns the ticks from the dongle coming back to the first ACK,
+// or -1 if the keyboard locks before that; charge is in nC
+// the keyboard doesn't scan the matrix until rf_ctrl_send_message() returns
+double recover_old(double dongle_back, double* charge, double* blocked)
+{
+	double end = 0;
+	*charge = 0;
+	double ack = send_message(0, OLD_ATTEMPTS, dongle_back, &end, charge);
+	*blocked = ack < 0 ? end : ack;
+	return ack < 0 ? -1 : ack - dongle_back;
+}
+
+// press_ticks is the time between the key presses during the outage, 0 for none
+double recover_new(double dongle_back, double press_ticks, double* charge)
+{
+	double end = 0;
+	double next_press = press_ticks;
+	*charge = 0;
+
+	link_result(0, true);
+	link_activity(0);
+
+	double ack = send_message(0, LINK_LOSS_ATTEMPTS, dongle_back, &end, charge);
+	if (ack >= 0)
+		return ack - dongle_back;
+
+	// the pings, on the scans
+	double t = end;
+	link_result((uint32_t) t, false);
+	for (;;)
+	{
+		t = ((uint32_t) t / SCAN_TICKS + 1) * SCAN_TICKS;
+
+		// the key state of a press is queued on the scan after it
+		if (press_ticks  &&  t >= next_press)
+		{
+			link_activity((uint32_t) t);
+			while (next_press <= t)
+				next_press += press_ticks;
+		}
+
+		if (!link_probe_due((uint32_t) t))
+			continue;
+
+		// the nRF has powered down since the last ping
+		*charge += NRF_START_NC;
+		if (t >= dongle_back)
+		{
+			*charge += TX_NC;
+			return t + 2 - dongle_back;
+		}
+
+		*charge += attempt_nc(PROBE_ARC);
+		t += attempt_ticks(PROBE_ARC);
+		link_result((uint32_t) t, false);
+	}
+}
+
+int main(void)
+{
+	const double outages_sec[] = {0.05, 0.2, 0.5, 1, 2, 5, 10, 20, 60, 300};
+	const int num_outages = sizeof outages_sec / sizeof outages_sec[0];
+	double charge, ms, blocked;
+	int cnt;
+
+	printf("%-10s %14s %14s %14s %14s\n", "outage s", "old blocked", "old recover", "new idle", "new typing");
+	for (cnt = 0; cnt < num_outages; ++cnt)
+	{
+		double back = outages_sec[cnt] * TICKS_PER_SEC;
+		char old_str[32];
+
+		ms = recover_old(back, &charge, &blocked);
+		if (ms < 0)
+			snprintf(old_str, sizeof old_str, "locked");
+		else
+			snprintf(old_str, sizeof old_str, "%.1fms", ms * 1000 / TICKS_PER_SEC);
+
+		double idle_ms = recover_new(back, 0, &charge) * 1000 / TICKS_PER_SEC;
+		ms = recover_new(back, PRESS_TICKS, &charge) * 1000 / TICKS_PER_SEC;
+
+		printf("%-10g %13.2fs %14s %12.1fms %12.1fms\n", outages_sec[cnt], blocked / TICKS_PER_SEC, old_str, idle_ms, ms);
+	}
+
+	// an hour without the dongle
+	double hour = 3600 * TICKS_PER_SEC;
+	recover_old(hour * 2, &charge, &blocked);
+	printf("\nthe first hour without the dongle, on top of the %.0fuA sleep:\n", SLEEP_UA);
+	printf("old: %.0fuC in the retries, then locked\n", charge / 1000);
+	recover_new(hour, 0, &charge);
+	printf("new: %.0fuC, %.2fuA on average\n", charge / 1000, charge / 1000 / 3600);
+
+	return 0;
+}
@@ -0,0 +1,153 @@
+// Checks the settings journal of the keyboard (keyb_ctrl/settings_journal.c)
+// against a RAM EEPROM (shim/avr/eeprom.h):
+// - an erased EEPROM has no record
+// - the newest save is loaded, also after the sequence number wraps
+// - a slot with a bad CRC, like after a battery change in the middle of a
+//   write, is skipped and the save before it is loaded
+// - a record of another version is skipped
+// - a record from an older firmware keeps its settings, and only the ones
+//   added since get the defaults
+//
+// usage: settings_test
+//
+// Prints the failed checks; the exit code is the number of failures.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <avr/eeprom.h>
+
+#include "settings_journal.h"
+
+#define NUM_SLOTS		((E2END + 1) / sizeof(settings_record_t))
+
+extern settings_record_t settings_journal[];
+extern uint8_t settings_slot;
+
+int failures = 0;
+
+#define CHECK(cond)		check(cond, #cond, __LINE__)
+
+static void check(bool ok, const char* what, int line)
+{
+	if (!ok)
+	{
+		printf("line %d: %s\n", line, what);
+		++failures;
+	}
+}
+
+static void erase(void)
+{
+	memset(settings_journal, 0xff, NUM_SLOTS * sizeof(settings_record_t));
+	settings_slot = NUM_SLOTS - 1;
+}
+
+static void fill_defaults(settings_record_t* rec)
+{
+	memset(rec, 0, sizeof *rec);
+	rec->version = SETTINGS_VERSION;
+	rec->size = SETTINGS_SIZE;
+	rec->led_brightness = 1;
+	rec->nrf_output_power = 6;
+	rec->sleep_profile = 1;
+	rec->deep_sleep_minutes = 30;
+	rec->osccal = 103;
+}
+
+// saves n records, the brightness is the number of the save
+static void save_n(settings_record_t* rec, int n)
+{
+	int cnt;
+	for (cnt = 1; cnt <= n; ++cnt)
+	{
+		rec->led_brightness = cnt & 0xff;
+		journal_save(rec);
+	}
+}
+
+int main(void)
+{
+	settings_record_t defaults, rec, loaded;
+
+	fill_defaults(&defaults);
+
+	CHECK(sizeof(settings_record_t) == 16);
+
+	// erased
+	erase();
+	CHECK(!journal_load(&loaded, &defaults));
+
+	// one save
+	rec = defaults;
+	rec.osccal = 99;
+	journal_save(&rec);
+	CHECK(journal_load(&loaded, &defaults));
+	CHECK(loaded.osccal == 99);
+
+	// the newest of many, with the sequence number wrapping a few times
+	erase();
+	rec = defaults;
+	save_n(&rec, 1000);
+	memset(&loaded, 0, sizeof loaded);
+	CHECK(journal_load(&loaded, &defaults));
+	CHECK(loaded.led_brightness == (1000 & 0xff));
+	CHECK(loaded.seq == rec.seq);
+
+	// the next save goes after the loaded slot
+	journal_save(&loaded);
+	CHECK(journal_load(&rec, &defaults));
+	CHECK(rec.seq == loaded.seq);
+
+	// a torn write of the newest slot: the previous save is loaded
+	erase();
+	rec = defaults;
+	save_n(&rec, 5);
+	((uint8_t*) &settings_journal[settings_slot])[3] ^= 0x55;
+	CHECK(journal_load(&loaded, &defaults));
+	CHECK(loaded.led_brightness == 4);
+
+	// another version is skipped
+	erase();
+	rec = defaults;
+	save_n(&rec, 3);
+	settings_journal[settings_slot].version = SETTINGS_VERSION + 1;
+	settings_journal[settings_slot].crc = calc_settings_crc(&settings_journal[settings_slot]);
+	CHECK(journal_load(&loaded, &defaults));
+	CHECK(loaded.led_brightness == 2);
+
+	// a record from a firmware that didn't have the heartbeat yet
+	erase();
+	rec = defaults;
+	rec.osccal = 97;
+	rec.usb_sync = true;
+	rec.heartbeat = 0x5a;		// whatever was in the byte then
+	rec.size = offsetof(settings_record_t, heartbeat);
+	rec.seq = 7;
+	rec.crc = calc_settings_crc(&rec);
+	settings_journal[3] = rec;
+	defaults.heartbeat = true;
+	CHECK(journal_load(&loaded, &defaults));
+	CHECK(loaded.osccal == 97);
+	CHECK(loaded.usb_sync == true);
+	CHECK(loaded.heartbeat == true);
+	CHECK(loaded.size == SETTINGS_SIZE);
+
+	// a record from a newer firmware keeps the settings we know
+	erase();
+	rec = defaults;
+	rec.osccal = 95;
+	rec.reserved[0] = 1;
+	rec.size = SETTINGS_SIZE + 1;
+	rec.crc = calc_settings_crc(&rec);
+	settings_journal[0] = rec;
+	CHECK(journal_load(&loaded, &defaults));
+	CHECK(loaded.osccal == 95);
+
+	if (failures == 0)
+		printf("all passed\n");
+
+	return failures;
+}
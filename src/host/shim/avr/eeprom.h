@@ -0,0 +1,20 @@
+#pragma once
+
+// The host stand-in for avr-libc's EEPROM functions. The EEMEM variables are
+// in RAM, so reading and writing them is a copy. This is the ATmega169P's 512
+// bytes; the host tools that build the keyboard's code use it.
+
+#include <string.h>
+
+#define E2END		0x1ff
+#define EEMEM
+
+static inline void eeprom_read_block(void* dst, const void* src, size_t n)
+{
+	memcpy(dst, src, n);
+}
+
+static inline void eeprom_update_block(const void* src, void* dst, size_t n)
+{
+	memcpy(dst, src, n);
+}
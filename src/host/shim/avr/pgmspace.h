@@ -0,0 +1,10 @@
+#pragma once
+
+// The host stand-in for avr-libc's flash access; flash is plain memory here.
+
+#include <stdint.h>
+#include <string.h>
+
+#define PSTR(s)				(s)
+#define pgm_read_byte(p)	(*(const uint8_t*)(p))
+#define strlen_P			strlen
@@ -0,0 +1,7 @@
+#pragma once
+
+// The host stand-in for mcu-lib's tgtdefs.h: the flash and xdata qualifiers of
+// the targets are plain memory on the host.
+
+#define __FLASH_ATTR
+#define __xdata
@@ -0,0 +1,6 @@
+#pragma once
+
+// the host stand-in for avr-libc's ATOMIC_BLOCK; there are no interrupts here
+
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_BLOCK(type)		for (int atomic_once_ = 1; atomic_once_; atomic_once_ = 0)
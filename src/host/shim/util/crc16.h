@@ -0,0 +1,21 @@
+#pragma once
+
+// the host stand-in for avr-libc's CRC functions; the same code as in its docs
+
+#include <stdint.h>
+
+static inline uint8_t _crc8_ccitt_update(uint8_t crc, uint8_t data)
+{
+	uint8_t i;
+
+	data ^= crc;
+	for (i = 0; i < 8; i++)
+	{
+		if (data & 0x80)
+			data = (data << 1) ^ 0x07;
+		else
+			data <<= 1;
+	}
+
+	return data;
+}
@@ -0,0 +1,256 @@
+// Measures what the text dictionary (common/text_dict.c) saves on the air. The
+// text of every send_text() call is encoded like the keyboard does it, cut into
+// MT_TEXT chunks like make_text_chunk() in keyb_ctrl/rf_ctrl.c, and expanded
+// again like msg_push_text() on the dongle; the expanded text has to match.
+//
+// usage: text_dict_bench [text_file]
+//
+// The file has the text of one send_text() call per line; \n and \xNN escapes
+// are allowed. Without a file the text of one main menu render is used.
+//
+// Every chunk costs a free-space query and the text packet, and every call
+// starts a new chunk. The keyboard can merge the calls when it queues faster
+// than it sends, so the packet counts are the worst case for both.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rf_protocol.h"
+#include "text_dict.h"
+
+// the nRF24L01+ at 2Mbps: preamble, address, 9 bit packet control field and
+// CRC-16 around the payload, and the TX settling before every packet
+#define FRAME_BITS			((1 + NRF_ADDR_SIZE + 2) * 8 + 9)
+#define BITS_PER_US			2.0
+#define TX_SETTLE_US		130.0
+#define QUERY_LEN			2			// the msg type and the msg_id
+
+// one main menu render, with some made up values
+static const char* menu_render[] = {
+	"\x01" "7G wireless\nfirmware build Oct 19 2026  12:00:00\nbattery voltage: ",
+	"2.95V",
+	"\nRF packet stats (total/retransmit/lost): ",
+	"18250/312/4",
+	"\nkeyboard's been on for ",
+	"2 hours 15 minutes 7 seconds\n",
+	"812uAh used, awake 95s, nRF on 41s\n",
+	"28411 scans, LEDs 3s at full brightness\n",
+	"battery life left: ",
+	"214 days",
+	"\n\nwhat do you want to do?\nF1 - change transmitter output power (current ",
+	"0",
+	"dBm)\nF2 - change LED brightness (current ",
+	"F2",
+	")\nF3 - lock keyboard/deep sleep (unlock with Func+Del+LCtrl)\n"
+		"F4 - reset RF packet stats\nF5 - refresh this menu\nF6 - change sleep profile (current ",
+	"balanced",
+	", ",
+	"1500us scan, 57 wake-ups in the first idle hour)",
+	"\nF7 - change deep sleep idle time (current ",
+	"30 minutes",
+	")\nF8 - toggle USB frame sync (current ",
+	"off",
+	")\nF9 - toggle heartbeat, syncs the LEDs while idle (current ",
+	"on",
+	")\nEsc - exit menu\n\n",
+};
+
+typedef struct
+{
+	unsigned	calls;
+	unsigned	chars;
+	unsigned	packets;
+	unsigned	payload;
+	double		air_us;
+} stats_t;
+
+static void count_packet(stats_t* st, unsigned len)
+{
+	++st->packets;
+	st->payload += len;
+	st->air_us += (FRAME_BITS + len * 8) / BITS_PER_US + TX_SETTLE_US;
+}
+
+// the encoding of send_text(); returns the length of the encoded text
+static unsigned encode(const char* msg, uint8_t* out, bool use_dict)
+{
+	uint16_t msglen = strlen(msg);
+	uint8_t matchlen, token;
+	unsigned len = 0;
+
+	while (msglen)
+	{
+		matchlen = use_dict ? text_dict_match(msg, false, msglen, &token) : 0;
+		if (matchlen == 0)
+		{
+			matchlen = 1;
+			token = *msg;
+		}
+
+		out[len++] = token;
+		msglen -= matchlen;
+		msg += matchlen;
+	}
+
+	return len;
+}
+
+// the expansion of msg_push_text(); returns the length of the expanded text
+static unsigned expand(const uint8_t* src, unsigned len, char* out)
+{
+	const char* entry;
+	uint8_t entry_len;
+	unsigned outlen = 0;
+
+	for (; len; ++src, --len)
+	{
+		if (!IS_TEXT_DICT_TOKEN(*src))
+		{
+			out[outlen++] = *src;
+		} else if ((entry = text_dict_entry(*src, &entry_len)) != NULL) {
+			memcpy(out + outlen, entry, entry_len);
+			outlen += entry_len;
+		}
+	}
+
+	return outlen;
+}
+
+// sends the text of one call; returns false if it didn't come out the same
+static bool send_call(stats_t* st, const char* msg, bool use_dict)
+{
+	size_t msglen = strlen(msg);
+	uint8_t* enc = malloc(msglen + 1);
+	char* dec = malloc(msglen + 1);
+	const char* entry;
+	unsigned enclen, pos, chunk_len, expanded, declen = 0;
+	uint8_t entry_len;
+	bool ok;
+
+	enclen = encode(msg, enc, use_dict);
+
+	// the chunks of make_text_chunk()
+	for (pos = 0; pos < enclen; pos += chunk_len)
+	{
+		chunk_len = expanded = 0;
+		while (chunk_len < MAX_TEXT_LEN  &&  pos + chunk_len < enclen)
+		{
+			entry_len = 1;
+			if (IS_TEXT_DICT_TOKEN(enc[pos + chunk_len]))
+			{
+				entry = text_dict_entry(enc[pos + chunk_len], &entry_len);
+				if (entry == NULL)
+					entry_len = 0;
+			}
+
+			if (expanded + entry_len > 0xff - 1)
+				break;
+
+			expanded += entry_len;
+			++chunk_len;
+		}
+
+		count_packet(st, QUERY_LEN);
+		count_packet(st, chunk_len + QUERY_LEN);
+
+		declen += expand(enc + pos, chunk_len, dec + declen);
+	}
+
+	ok = declen == msglen  &&  memcmp(dec, msg, msglen) == 0;
+
+	++st->calls;
+	st->chars += msglen;
+
+	free(enc);
+	free(dec);
+
+	return ok;
+}
+
+// reads the calls from the file; replaces the \n and \xNN escapes
+static char** read_calls(const char* fname, unsigned* num_calls)
+{
+	FILE* f = fopen(fname, "r");
+	char line[1024];
+	char** calls = NULL;
+	char* out;
+	char* in;
+
+	*num_calls = 0;
+	if (f == NULL)
+		return NULL;
+
+	while (fgets(line, sizeof line, f))
+	{
+		line[strcspn(line, "\r\n")] = '\0';
+		for (in = out = line; *in; ++out)
+		{
+			if (in[0] == '\\'  &&  in[1] == 'n')
+			{
+				*out = '\n';
+				in += 2;
+			} else if (in[0] == '\\'  &&  in[1] == 'x') {
+				*out = (char) strtoul(in + 2, &in, 16);
+			} else {
+				*out = *in++;
+			}
+		}
+		*out = '\0';
+
+		if (line[0] == '\0')
+			continue;
+
+		calls = realloc(calls, (*num_calls + 1) * sizeof *calls);
+		calls[(*num_calls)++] = strdup(line);
+	}
+
+	fclose(f);
+
+	return calls;
+}
+
+static void print_stats(const char* name, const stats_t* st)
+{
+	printf("%-10s  %7u  %13u  %11.1f\n", name, st->packets, st->payload, st->air_us / 1000);
+}
+
+int main(int argc, char* argv[])
+{
+	const char** calls = menu_render;
+	unsigned num_calls = sizeof menu_render / sizeof menu_render[0];
+	stats_t plain = {0}, dict = {0};
+	unsigned cnt, mismatches = 0;
+
+	if (argc > 1)
+	{
+		calls = (const char**) read_calls(argv[1], &num_calls);
+		if (calls == NULL)
+		{
+			fprintf(stderr, "can't read %s\n", argv[1]);
+			return 1;
+		}
+	}
+
+	for (cnt = 0; cnt < num_calls; ++cnt)
+	{
+		send_call(&plain, calls[cnt], false);
+		if (!send_call(&dict, calls[cnt], true))
+		{
+			printf("call %u doesn't expand to the same text\n", cnt + 1);
+			++mismatches;
+		}
+	}
+
+	printf("%u chars in %u send_text() calls\n\n", plain.chars, plain.calls);
+	printf("            packets  payload bytes  air time ms\n");
+	print_stats("plain", &plain);
+	print_stats("dictionary", &dict);
+
+	if (mismatches == 0)
+		printf("\nthe expanded text matches\n");
+
+	return mismatches;
+}
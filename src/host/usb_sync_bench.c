@@ -0,0 +1,177 @@
+// Simulates the way from a key press to the host taking the keyboard report,
+// with and without the USB frame sync (keyb_ctrl/usb_sync.c). It reports the
+// scans per minute while typing and the percentiles of the time from the key
+// press to the IN token that takes the report.
+//
+// usage: usb_sync_bench [scan_ticks]
+//
+// The keyboard scans every scan_ticks (default 8, about 2ms) Timer2 ticks while
+// typing. Its 32KHz crystal runs 50ppm slow against the USB clock. The host polls
+// the dongle once per 1ms frame, at a fixed point of the frame. The report
+// reaches the dongle USB_SYNC_LEAD_UP_US after the wake-up, give or take a bit,
+// and the dongle sends a timing beacon with the ACK of the next packet.
+// The key presses are a synthetic hour of typing with a fixed seed.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "usb_sync.h"
+
+#define US_PER_TICK			(15625.0 / 64)
+#define CLOCK_DRIFT			50e-6		// the keyboard's clock is slow by this much
+#define IN_PHASE_US			300.0		// the host's IN token in the 1ms frame
+#define LEAD_JITTER_US		60.0		// the scan and the RF take a bit more or less
+
+double* presses = NULL;
+int num_presses = 0;
+int presses_size = 0;
+
+// a small LCG so the runs are the same everywhere
+uint32_t rnd_state = 12345;
+
+double rnd(double min, double max)
+{
+	rnd_state = rnd_state * 1103515245 + 12345;
+	return min + (max - min) * ((rnd_state >> 8) & 0xffff) / 65536.0;
+}
+
+void add_press(double us)
+{
+	if (num_presses == presses_size)
+	{
+		presses_size = presses_size ? presses_size * 2 : 1024;
+		presses = realloc(presses, presses_size * sizeof *presses);
+		if (presses == NULL)
+		{
+			perror("realloc");
+			exit(1);
+		}
+	}
+
+	presses[num_presses++] = us;
+}
+
+// words, sentences and short pauses; the long ones don't matter here
+void make_synthetic_presses(double duration_us)
+{
+	double t = 1e6;
+	int words = 0;
+	while (t < duration_us)
+	{
+		int chars = (int) rnd(2, 9);
+		while (chars--)
+		{
+			add_press(t);
+			t += rnd(90, 300) * 1000;
+		}
+
+		add_press(t);
+		t += rnd(120, 450) * 1000;
+
+		if (++words % 12 == 0)
+			t += rnd(1000, 4000) * 1000;
+	}
+}
+
+// the time of the first IN token at or after t (both on the USB clock)
+double next_in_token(double t)
+{
+	double frame = t - IN_PHASE_US;
+	return IN_PHASE_US + 1000 * (double)(int64_t)((frame + 999.999) / 1000);
+}
+
+int cmp_double(const void* a, const void* b)
+{
+	double da = *(const double*) a, db = *(const double*) b;
+	return da < db ? -1 : da > db;
+}
+
+double percentile(const double* sorted, int num, double pct)
+{
+	int ndx = (int)(pct / 100 * (num - 1) + 0.5);
+	return sorted[ndx];
+}
+
+void simulate(const char* name, uint8_t scan_ticks, bool use_sync)
+{
+	double* latencies = malloc(num_presses * sizeof *latencies);
+	int num_latencies = 0;
+
+	// the ticks start over; the last beacon of the previous run is in the future
+	// for usb_sync.c, so it's not valid
+	uint32_t tick = 0, scans = 0;
+	int next_press = 0;
+	bool have_key_state = false;		// a key state is waiting for its beacon
+	uint32_t key_state_tick = 0;
+	uint16_t key_state_wait = 0;
+	double end_us = presses[num_presses - 1] + 1e6;
+	double t = 0;
+	while (t < end_us)
+	{
+		++scans;
+		t = tick * US_PER_TICK * (1 + CLOCK_DRIFT);
+
+		if (next_press < num_presses  &&  presses[next_press] <= t)
+		{
+			// the release goes out in a separate report, but it doesn't matter here
+			double arrival = t + USB_SYNC_LEAD_UP_US + rnd(-LEAD_JITTER_US, LEAD_JITTER_US);
+			double in_token = next_in_token(arrival);
+
+			while (next_press < num_presses  &&  presses[next_press] <= t)
+				latencies[num_latencies++] = in_token - presses[next_press++];
+
+			// the ACK of this packet has the beacon of the previous key state
+			if (have_key_state)
+				usb_sync_beacon(key_state_tick, true, key_state_wait);
+
+			have_key_state = true;
+			key_state_tick = tick;
+			key_state_wait = (uint16_t)(in_token - arrival);
+		}
+
+		uint8_t ticks = scan_ticks;
+		if (use_sync  &&  usb_sync_is_valid(tick))
+			ticks = usb_sync_align(tick, ticks);
+
+		tick += ticks;
+	}
+
+	qsort(latencies, num_latencies, sizeof *latencies, cmp_double);
+
+	printf("%-10s %10.1f %8.3f %8.3f %8.3f %8.3f\n", name,
+			scans / (end_us / 60e6),
+			percentile(latencies, num_latencies, 50) / 1000,
+			percentile(latencies, num_latencies, 90) / 1000,
+			percentile(latencies, num_latencies, 99) / 1000,
+			latencies[num_latencies - 1] / 1000);
+
+	free(latencies);
+}
+
+int main(int argc, char* argv[])
+{
+	uint8_t scan_ticks = 8;
+	if (argc > 1)
+		scan_ticks = (uint8_t) atoi(argv[1]);
+
+	if (scan_ticks < 4)
+	{
+		fprintf(stderr, "scan_ticks has to be at least 4\n");
+		return 1;
+	}
+
+	make_synthetic_presses(3600 * 1e6);
+
+	printf("%d key presses, scan every %u ticks (%.2fms) while typing\n\n",
+			num_presses, scan_ticks, scan_ticks * US_PER_TICK / 1000);
+	printf("%-10s %10s %8s %8s %8s %8s\n", "", "scans/min", "p50 ms", "p90 ms", "p99 ms", "max ms");
+
+	simulate("plain", scan_ticks, false);
+	simulate("synced", scan_ticks, true);
+
+	free(presses);
+
+	return 0;
+}
@@ -21,8 +21,15 @@
 #include "keycode.h"
 #include "sleeping.h"
 #include "ctrl_settings.h"
+#include "text_dict.h"
+#include "clock.h"
+#include "osccal.h"
+#include "energy.h"
+#include "battery.h"
+#include "link.h"
 
 // returns false if we should enter the menu, true if we should lock the keyboard
+// the keyboard is also locked (deep sleep) after get_deep_sleep_minutes() without a key press
 bool process_normal(void)
 {
 	bool waiting_for_all_keys_up = false;
@@ -30,8 +37,12 @@ bool process_normal(void)
 	bool ret_val = false;
 
 	do {
-		wait_for_matrix_change();
+		if (!wait_for_matrix_change(get_deep_sleep_minutes() * 60))
+			return true;
 
+		// building the report is a short burst of work
+		clock_fast();
+		
 		// make a key state report
 		rf_msg_key_state_report_t report;
 		report.msg_type = MT_KEY_STATE;
@@ -109,18 +120,22 @@ bool process_normal(void)
 			}
 		}
 
-		// send the report and wait for ACK
-		if (!rf_ctrl_send_message(&report, num_keys + 3))
-			return true;
-
-		// flush the ACK payloads
-		rf_ctrl_process_ack_payloads(NULL, NULL);
+		clock_slow();
+		
+		// queue the report; it goes out before anything else that's waiting
+		// if the dongle doesn't answer, the report waits while rf_ctrl looks for
+		// the dongle, and we keep scanning
+		rf_ctrl_queue_message(RF_PRIO_KEY_STATE, &report, num_keys + 3);
+		rf_ctrl_send_queued();
 		
 	} while (!waiting_for_all_keys_up  ||  are_all_keys_up);
 	
 	return ret_val;
 }
 
+// the text waits this long for a lost link before it gives up and the keyboard locks
+#define TEXT_LINK_WAIT_SEC		30
+
 bool send_text(const char* msg, bool is_flash, bool wait_for_finish)
 {
 #ifdef DBGPRINT
@@ -140,69 +155,62 @@ bool send_text(const char* msg, bool is_flash, bool wait_for_finish)
 	return true;
 #endif
 
-	// this message id is used to avoid presenting the same package to the dongle in case dongle
-	// received the message, but the keyboard did not receive the ACK
-	static uint8_t msg_id = 1;
-	
-	rf_msg_text_t txt_msg;
-	txt_msg.msg_type = MT_TEXT;
-
-	// send the message in chunks of MAX_TEXT_LEN
+	// queue the message for sending
+	// the phrases found in the dictionary are replaced with their one byte token
 	uint16_t msglen = is_flash ? strlen_P(msg) : strlen(msg);
-	uint8_t chunklen, msg_bytes_free;
+	uint8_t matchlen, token;
+	rf_queue_result_t result;
 	while (msglen)
 	{
-		// flush the ACK payload
-		rf_ctrl_process_ack_payloads(&msg_bytes_free, NULL);
-	
-		// copy a chunk of the message
-		chunklen = msglen > MAX_TEXT_LEN ? MAX_TEXT_LEN : msglen;
-		if (is_flash)
-			memcpy_P(txt_msg.text, msg, chunklen);
-		else
-			memcpy(txt_msg.text, msg, chunklen);
-
-		msglen -= chunklen;
-		msg += chunklen;
-
-		// query the free space of the buffer on the dongle to see if
-		// it is large enough to store the next chunk
+		matchlen = text_dict_match(msg, is_flash, msglen, &token);
+		if (matchlen == 0)
+		{
+			matchlen = 1;
+			token = is_flash ? pgm_read_byte(msg) : *msg;
+		}
 
-		for (;;)
+		// send some of the queue if it's full
+		while (!rf_ctrl_queue_text(token))
 		{
-			// send an empty text message; this causes the dongle to respond with ACK payload
-			// that contains the number of bytes available in the dongle's text buffer
-			if (!rf_ctrl_send_message(&txt_msg, 2))		// 1 byte for the message type ID, 1 for the msg_id
+			result = rf_ctrl_send_queued();
+			if (!link_is_up()  &&  !rf_ctrl_wait_for_link(TEXT_LINK_WAIT_SEC))
 				return false;
-			
-			rf_ctrl_process_ack_payloads(&msg_bytes_free, NULL);
-			
-			// enough space in the dongle buffer?
-			if (msg_bytes_free > chunklen + 1)
-				break;
-				
-			sleep_ticks(40);		// doze off a little; roughly 10ms
+
+			if (result == RF_QUEUE_IDLE)
+			{
+				rf_ctrl_power_down_if_due();
+				sleep_ticks(40);		// doze off a little; roughly 10ms
+			}
 		}
-		
-		// set the message id and send it on it's way
-		msg_id = msg_id == 0xff ? 1 : msg_id + 1;
-		txt_msg.msg_id = msg_id;
-		if (!rf_ctrl_send_message(&txt_msg, chunklen + 2))
-			return false;
-	}
 
-	// flush the ACK payload(s)
-	rf_ctrl_process_ack_payloads(NULL, NULL);
+		msglen -= matchlen;
+		msg += matchlen;
+	}
 
 	// wait for the buffer on the dongle to become empty
 	// this will ensure that all the keystrokes are sent to the host and that subsequent
 	// keystrokes we're sending won't mess up the text we want output at the host
 	if (wait_for_finish)
 	{
-		uint8_t msg_bytes_capacity = 0;
+		// a short outage only delays the text
+		while (!rf_ctrl_flush_queue())
+		{
+			if (!rf_ctrl_wait_for_link(TEXT_LINK_WAIT_SEC))
+				return false;
+		}
+
+		rf_msg_text_t txt_msg;
+		txt_msg.msg_type = MT_TEXT;
+		
+		uint16_t msg_bytes_free = 0, msg_bytes_capacity = 0;
 		do {
 			if (!rf_ctrl_send_message(&txt_msg, 2))
-				return false;
+			{
+				if (!rf_ctrl_wait_for_link(TEXT_LINK_WAIT_SEC))
+					return false;
+
+				continue;
+			}
 
 			rf_ctrl_process_ack_payloads(&msg_bytes_free, &msg_bytes_capacity);
 		} while (msg_bytes_free == 0  ||  msg_bytes_free != msg_bytes_capacity);
@@ -211,49 +219,6 @@ bool send_text(const char* msg, bool is_flash, bool wait_for_finish)
 	return true;
 }
 
-// defining this makes the ADC use the two least significant bits, but adds 24 bytes to the binary
-#define PREC_BATT_VOLTAGE
-
-// returns the battery voltage in 10mV units
-// for instance: get_battery_voltage() returning 278 equals a voltage of 2.78V
-uint16_t get_battery_voltage(void)
-{
-	power_adc_enable();
-	
-	ADMUX = _B0(REFS1) | _B1(REFS0)	// AVCC with external capacitor at AREF pin
-#ifndef PREC_BATT_VOLTAGE	
-			| _BV(ADLAR)			// left adjust ADC - drops the two LSBs
-#endif
-			| 0b11110;				// measure 1.1v internal reference
-
-	ADCSRA = _BV(ADEN)					// enable ADC
-			| _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0)	// prescaler 128
-			| _BV(ADSC);				// start conversion
-	
-	// wait for the conversion to finish
-	loop_until_bit_is_set(ADCSRA, ADIF);
-
-	// remember the result
-#ifdef PREC_BATT_VOLTAGE
-	uint16_t adc_result = ADC;
-#else	
-	uint8_t adc_result = ADCH;
-#endif
-	
-	// clear the ADIF bit by writing one
-	SetBit(ADCSRA, ADIF);
-	
-	ADCSRA = 0;				// disable ADC
-	
-	power_adc_disable();	// ADC power off
-	
-#ifdef PREC_BATT_VOLTAGE
-	return 112640 / adc_result;
-#else
-	return 28050 / adc_result;
-#endif
-}
-
 // makes a battery voltage string in the 2.34V format
 // the buff buffer has to be at least 6 bytes long
 void get_battery_voltage_str(char* buff)
@@ -311,6 +276,11 @@ bool process_menu(void)
 			
 		get_battery_voltage_str(string_buff);
 		if (!send_text(string_buff, false, false))		return true;
+		
+		if (get_battery_level() == BATT_LEVEL_LOW)
+			send_text(PSTR(" (low, saving power)"), true, false);
+		else if (get_battery_level() == BATT_LEVEL_CRITICAL)
+			send_text(PSTR(" (critical, saving power)"), true, false);
 
 		// RF stats
 		if (!send_text(PSTR("\nRF packet stats (total/retransmit/lost): "), true, false))		return true;
@@ -355,6 +325,32 @@ bool process_menu(void)
 		
 		if (!send_text(string_buff, false, false))		return true;
 		
+		// where the charge went
+		ultoa(energy_get_used_uah(), string_buff, 10);
+		strcat_P(string_buff, PSTR("uAh used, awake "));
+		ultoa(energy_awake_ticks / 4096, strchr(string_buff, '\0'), 10);
+		strcat_P(string_buff, PSTR("s, nRF on "));
+		ultoa(energy_nrf_ticks / 4096, strchr(string_buff, '\0'), 10);
+		strcat_P(string_buff, PSTR("s\n"));
+		if (!send_text(string_buff, false, false))		return true;
+
+		ultoa(energy_scans, string_buff, 10);
+		strcat_P(string_buff, PSTR(" scans, LEDs "));
+		ultoa(energy_get_led_weighted() / (255UL * 128), strchr(string_buff, '\0'), 10);	// 128 frames per second
+		strcat_P(string_buff, PSTR("s at full brightness\n"));
+		if (!send_text(string_buff, false, false))		return true;
+		
+		if (!send_text(PSTR("battery life left: "), true, false))		return true;
+		uint16_t hours_left = energy_get_hours_left();
+		if (hours_left == 0xffff)
+		{
+			strcpy_P(string_buff, PSTR("unknown yet"));
+		} else {
+			utoa(hours_left / 24, string_buff, 10);
+			strcat_P(string_buff, PSTR(" days"));
+		}
+		if (!send_text(string_buff, false, false))		return true;
+		
 		// menu
 		if (!send_text(PSTR("\n\nwhat do you want to do?\n"
 							"F1 - change transmitter output power (current "), true, false))		return true;
@@ -385,15 +381,49 @@ bool process_menu(void)
 
 		if (!send_text(string_buff, false, false))		return true;
 		
-		if (!send_text(PSTR(")\nF3 - lock keyboard (unlock with Func+Del+LCtrl)\n"
+		if (!send_text(PSTR(")\nF3 - lock keyboard/deep sleep (unlock with Func+Del+LCtrl)\n"
 							"F4 - reset RF packet stats\n"
 							"F5 - refresh this menu\n"
-							"Esc - exit menu\n\n"), true, false))
+							"F6 - change sleep profile (current "), true, false))
+			return true;
+
+		switch (get_sleep_profile())
+		{
+		case SLEEP_PROFILE_GAMING:		send_text(PSTR("gaming"), true, false); 	break;
+		case SLEEP_PROFILE_BALANCED:	send_text(PSTR("balanced"), true, false); 	break;
+		case SLEEP_PROFILE_BATTERY:		send_text(PSTR("battery saver"), true, false); 	break;
+		}
+
+		// the scan latency and the wake-ups of the first hour after the last key press
+		if (!send_text(PSTR(", "), true, false))		return true;
+		utoa(get_scan_latency_us(), string_buff, 10);
+		strcat_P(string_buff, PSTR("us scan, "));
+		ultoa(get_wakeups_per_hour(), strchr(string_buff, '\0'), 10);
+		strcat_P(string_buff, PSTR(" wake-ups in the first idle hour)"));
+		if (!send_text(string_buff, false, false))		return true;
+
+		if (!send_text(PSTR("\nF7 - change deep sleep idle time (current "), true, false))		return true;
+		if (get_deep_sleep_minutes() == 0)
+		{
+			strcpy_P(string_buff, PSTR("never"));
+		} else {
+			itoa(get_deep_sleep_minutes(), string_buff, 10);
+			strcat_P(string_buff, PSTR(" minutes"));
+		}
+		if (!send_text(string_buff, false, false))		return true;
+
+		if (!send_text(PSTR(")\nF8 - toggle USB frame sync (current "), true, false))		return true;
+		if (!send_text(get_usb_sync() ? PSTR("on") : PSTR("off"), true, false))		return true;
+
+		if (!send_text(PSTR(")\nF9 - toggle heartbeat, syncs the LEDs while idle (current "), true, false))		return true;
+		if (!send_text(get_heartbeat() ? PSTR("on") : PSTR("off"), true, false))		return true;
+
+		if (!send_text(PSTR(")\nEsc - exit menu\n\n"), true, false))
 			return true;
 
 		do {
 			keycode = get_key_input();
-		} while (!(keycode >= KC_F1  &&  keycode <= KC_F5)  &&  keycode != KC_ESC);
+		} while (!(keycode >= KC_F1  &&  keycode <= KC_F9)  &&  keycode != KC_ESC);
 
 		if (keycode == KC_F1)
 		{
@@ -434,10 +464,54 @@ bool process_menu(void)
 			// reset the counters to 0
 			plos_total = arc_total = rf_packets_total = 0;
 			
+		} else if (keycode == KC_F6) {
+			if (!send_text(PSTR("select sleep profile:\nF1 gaming\nF2 balanced\nF3 battery saver\n"), true, false))
+				return true;
+			
+			while (1)
+			{
+				keycode = get_key_input();
+				if (keycode >= KC_F1  &&  keycode <= KC_F3)
+				{
+					if (keycode == KC_F1)	set_sleep_profile(SLEEP_PROFILE_GAMING);
+					if (keycode == KC_F2)	set_sleep_profile(SLEEP_PROFILE_BALANCED);
+					if (keycode == KC_F3)	set_sleep_profile(SLEEP_PROFILE_BATTERY);
+					break;
+				}
+			}
+			
+		} else if (keycode == KC_F7) {
+			if (!send_text(PSTR("deep sleep after:\nF1 never\nF2 10 minutes\nF3 30 minutes\nF4 60 minutes\nF5 120 minutes\n"), true, false))
+				return true;
+			
+			while (1)
+			{
+				keycode = get_key_input();
+				if (keycode >= KC_F1  &&  keycode <= KC_F5)
+				{
+					if (keycode == KC_F1)	set_deep_sleep_minutes(0);
+					if (keycode == KC_F2)	set_deep_sleep_minutes(10);
+					if (keycode == KC_F3)	set_deep_sleep_minutes(30);
+					if (keycode == KC_F4)	set_deep_sleep_minutes(60);
+					if (keycode == KC_F5)	set_deep_sleep_minutes(120);
+					break;
+				}
+			}
+			
+		} else if (keycode == KC_F8) {
+
+			set_usb_sync(!get_usb_sync());
+			
+		} else if (keycode == KC_F9) {
+
+			set_heartbeat(!get_heartbeat());
+			
 		} else if (keycode == KC_ESC) {
 
 			start_led_sequence(led_seq_menu_end);
-			send_text(PSTR("\nexiting menu, you can type now\n"), true, true);
+			
+			// don't wait for this one; it is sent while we're typing
+			send_text(PSTR("\nexiting menu, you can type now\n"), true, false);
 			break;
 		}
 	}
@@ -449,13 +523,24 @@ void process_lock(void)
 {
 	start_led_sequence(led_seq_lock);
 
+	// send the text that's still waiting, we won't be sending anything while locked
+	rf_ctrl_flush_queue();
+	rf_ctrl_suspend();
+
+	// the columns are on PORTC which has no pin change interrupts, so instead of
+	// the full matrix scan we only drive the rows of the unlock keys on each wake-up
+	uint16_t unlock_rows = get_keycode_row_mask(KC_FN0)
+							| get_keycode_row_mask(KC_LCTRL)
+							| get_keycode_row_mask(KC_RCTRL)
+							| get_keycode_row_mask(KC_DEL)
+							| get_keycode_row_mask(KC_KP_DOT);
+	
 	for (;;)
 	{
-		sleep_ticks(0xfe);	// long, about 62ms x 3 = 190ms
-		sleep_ticks(0xfe);
-		sleep_ticks(0xfe);
+		sleep_max(4);		// long, about 62ms x 4 = 250ms
 
-		if (matrix_scan()
+		if (matrix_probe_rows(unlock_rows)
+				&&  matrix_scan()
 				&&  get_num_keys_pressed() == 3
 				&&  is_pressed_keycode(KC_FN0)
 				&&  (is_pressed_keycode(KC_LCTRL)  ||  is_pressed_keycode(KC_RCTRL))
@@ -465,6 +550,7 @@ void process_lock(void)
 		}
 	}
 
+	rf_ctrl_resume();
 	start_led_sequence(led_seq_lock);
 }
 
@@ -478,8 +564,10 @@ void init_hw(void)
 	power_usart0_disable();	// init_dbg() will power on the USART if called
 	SetBit(ACSR, ACD);		// analog comparator off
 	
-	OSCCAL = 103;			// RC oscillator calibration done externally.
-							// for now, just hard-code it to this value
+	init_settings();
+	
+	OSCCAL = get_osccal();	// the last calibration; it's recalibrated after the boot
+							// sequence when the 32KHz crystal is stable
 	
 	// default all pins to input with pullups
 	DDRA = 0;	PORTA = 0xff;
@@ -511,9 +599,12 @@ int main(void)
 	sei();		// enable interrupts
 
 	// 'play' a LED sequence while waiting for the 32KHz crystal to stabilize
+	// the LED PWM runs from the crystal, so the sequence starts when the crystal does
 	start_led_sequence(led_seq_boot);
 	while (are_leds_on())
-		;
+		sleep_ticks(0xfe);
+
+	osccal_calibrate();
 	
 	for (;;)
 	{
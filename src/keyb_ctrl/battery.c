@@ -0,0 +1,103 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <avr/io.h>
+#include <avr/power.h>
+#include <avr/sleep.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+
+#include "battery.h"
+#include "sleeping.h"
+#include "avrutils.h"
+
+#define BATT_REFRESH_SEC		600		// measure every 10 minutes
+#define BATT_NUM_SAMPLES		16		// summed, this gives 14 bits
+
+uint16_t battery_voltage = 0;			// the cached voltage, 0 if not measured yet
+uint16_t battery_measured;				// the get_seconds() of the measurement
+uint8_t battery_level = BATT_LEVEL_OK;
+
+// wakes us from the ADC noise reduction sleep
+EMPTY_INTERRUPT(ADC_vect);
+
+// does one conversion in the ADC noise reduction mode, so the CPU and
+// the I/O clocks are stopped while the ADC samples
+uint16_t adc_convert(void)
+{
+	set_sleep_mode(SLEEP_MODE_ADC);
+	sleep_enable();
+
+	// other interrupts (Timer2) can wake us before the conversion is done
+	SetBit(ADCSRA, ADSC);
+	do {
+		sleep_cpu();
+	} while (ADCSRA & _BV(ADSC));
+	
+	sleep_disable();
+	set_sleep_mode(SLEEP_MODE_PWR_SAVE);
+
+	return ADC;
+}
+
+uint16_t measure_battery_voltage(void)
+{
+	power_adc_enable();
+	
+	ADMUX = _B0(REFS1) | _B1(REFS0)	// AVCC with external capacitor at AREF pin
+			| 0b11110;				// measure 1.1v internal reference
+
+	ADCSRA = _BV(ADEN)					// enable ADC
+			| _BV(ADIE)					// interrupt wakes us from the sleep
+			| _BV(ADPS1) | _BV(ADPS0);	// prescaler 8 - 115.2KHz at 921.6KHz
+	
+	// let the bandgap reference settle and throw away the first conversion
+	_delay_us(100);
+	adc_convert();
+	
+	uint16_t adc_sum = 0;
+	uint8_t cnt;
+	for (cnt = 0; cnt < BATT_NUM_SAMPLES; ++cnt)
+		adc_sum += adc_convert();
+	
+	ADCSRA = 0;				// disable ADC
+	
+	power_adc_disable();	// ADC power off
+	
+	// Vbatt = 1.1V * 1024 / ADC
+	return 112640UL * BATT_NUM_SAMPLES / adc_sum;
+}
+
+uint16_t get_battery_voltage(void)
+{
+	if (battery_voltage == 0  ||  get_seconds() - battery_measured >= BATT_REFRESH_SEC)
+	{
+		battery_voltage = measure_battery_voltage();
+		battery_measured = get_seconds();
+	}
+	
+	return battery_voltage;
+}
+
+uint8_t get_battery_level(void)
+{
+	return battery_level;
+}
+
+void battery_check(void)
+{
+	uint16_t voltage = get_battery_voltage();
+	uint8_t prev_level = battery_level;
+	
+	// the level only goes down; a tired cell recovers a little while resting,
+	// but we don't want to switch back and forth
+	if (voltage < BATT_CRITICAL_VOLTAGE)
+		battery_level = BATT_LEVEL_CRITICAL;
+	else if (voltage < BATT_LOW_VOLTAGE  &&  battery_level < BATT_LEVEL_LOW)
+		battery_level = BATT_LEVEL_LOW;
+
+	// switch to the battery saver when the battery gets low; the LED brightness
+	// and the RF retries check the level when they are used
+	if (prev_level == BATT_LEVEL_OK  &&  battery_level != BATT_LEVEL_OK)
+		select_sleep_profile(SLEEP_PROFILE_BATTERY);
+}
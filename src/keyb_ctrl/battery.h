@@ -0,0 +1,24 @@
+#pragma once
+
+// returns the battery voltage in 10mV units
+// for instance: get_battery_voltage() returning 278 equals a voltage of 2.78V
+// the measurement is cached and refreshed every few minutes
+uint16_t get_battery_voltage(void);
+
+// the low battery power policy
+#define BATT_LEVEL_OK				0
+#define BATT_LEVEL_LOW				1		// battery saver sleep profile, dim LEDs
+#define BATT_LEVEL_CRITICAL			2		// also fewer RF retries
+
+// the thresholds in 10mV units
+#define BATT_LOW_VOLTAGE			230
+#define BATT_CRITICAL_VOLTAGE		210
+
+// the LED brightness cap and the max RF attempts in the low battery levels
+#define BATT_LOW_LED_BRIGHTNESS		20
+#define BATT_CRITICAL_RF_ATTEMPTS	8
+
+uint8_t get_battery_level(void);
+
+// refreshes the battery voltage if needed and applies the power policy; call while idle
+void battery_check(void);
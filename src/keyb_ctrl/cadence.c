@@ -0,0 +1,56 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cadence.h"
+
+#define EWMA_SHIFT		3		// the new interval has a weight of 1/8
+
+uint16_t ewma_interval = (CADENCE_BURST_GAP / 4) << EWMA_SHIFT;		// fixed point, ticks << EWMA_SHIFT
+uint32_t last_press = 0;
+uint8_t prev_keys_pressed = 0;
+
+void cadence_key_event(uint32_t now, uint8_t keys_pressed)
+{
+	// we only care about the key presses
+	if (keys_pressed > prev_keys_pressed)
+	{
+		uint32_t interval = now - last_press;
+
+		// only the presses in a burst update the average
+		if (interval < CADENCE_BURST_GAP)
+			ewma_interval += (int16_t)(interval - (ewma_interval >> EWMA_SHIFT));
+
+		last_press = now;
+	}
+
+	prev_keys_pressed = keys_pressed;
+}
+
+uint8_t cadence_next_ticks(uint32_t now, uint8_t fast_ticks, uint8_t schedule_ticks)
+{
+	// a key is down, the release is coming
+	if (prev_keys_pressed)
+		return fast_ticks;
+
+	// keep scanning fast while the next press in the burst is likely
+	uint32_t hold = (ewma_interval >> EWMA_SHIFT) * 3;
+	if (hold < CADENCE_MIN_HOLD)
+		hold = CADENCE_MIN_HOLD;
+	else if (hold > CADENCE_MAX_HOLD)
+		hold = CADENCE_MAX_HOLD;
+
+	uint32_t since_press = now - last_press;
+	if (since_press < hold)
+		return fast_ticks;
+
+	// ramp up to the schedule's interval; each scan is about 1/16 longer than
+	// the previous, so the schedule sets the latency once the ramp is done
+	uint32_t ticks = fast_ticks + ((since_press - hold) >> 4);
+
+	return ticks < schedule_ticks ? ticks : schedule_ticks;
+}
+
+uint16_t cadence_get_interval(void)
+{
+	return ewma_interval >> EWMA_SHIFT;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+// The typing cadence predictor picks the time between two matrix scans.
+//
+// It keeps an EWMA of the intervals between key presses in a burst of typing.
+// While the next key press is expected (keys are down, or we are within a few
+// average intervals of the last press) we scan at the fast interval of the sleep
+// profile. After that the interval ramps up to the interval of the sleep
+// schedule, and never goes over it.
+//
+// There's no AVR specific code in here; the host replay benchmark uses it too.
+
+// the intervals between presses longer than this end a burst; 0.5 sec
+#define CADENCE_BURST_GAP		2048
+
+// the limits of the time we keep scanning fast after a key press in a burst
+#define CADENCE_MIN_HOLD		1024		// 0.25 sec
+#define CADENCE_MAX_HOLD		8192		// 2 sec
+
+// call after a matrix change
+// now is in 244us ticks, keys_pressed is the number of keys down after the change
+void cadence_key_event(uint32_t now, uint8_t keys_pressed);
+
+// returns the ticks to sleep before the next scan
+// fast_ticks is the scan interval while typing, schedule_ticks is the interval
+// of the sleep schedule at this time
+uint8_t cadence_next_ticks(uint32_t now, uint8_t fast_ticks, uint8_t schedule_ticks);
+
+// the average interval between key presses in a burst, in ticks
+uint16_t cadence_get_interval(void);
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <avr/power.h>
+#include <util/delay.h>
+
+#include "energy.h"
+
+// The RC oscillator is calibrated to 7.3728MHz and the CKDIV8 fuse divides it down
+// to F_CPU (921.6KHz). For the short bursts of work (the matrix scan, building the
+// key state report, SPI to the nRF) the prescaler is switched to 2, and the MCU runs
+// 4 times faster. The ATmega169PV can do up to 4MHz down to 1.8V.
+//
+// _delay_us() and _delay_ms() are calculated for F_CPU, so the code running on
+// the fast clock has to use delay_us_fast(). Switch back to the slow clock before
+// sleeping, busy waiting with _delay_*() or using the UART.
+
+#define CLOCK_FAST_FACTOR		4
+#define F_CPU_FAST				(F_CPU * CLOCK_FAST_FACTOR)
+
+// the time on the fast clock is counted in energy_fast_ticks
+#define clock_fast()			do { clock_prescale_set(clock_div_2); energy_clock_fast(); } while (0)
+#define clock_slow()			do { energy_clock_slow(); clock_prescale_set(clock_div_8); } while (0)
+
+#define delay_us_fast(us)		_delay_us((us) * CLOCK_FAST_FACTOR)
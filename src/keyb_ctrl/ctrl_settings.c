@@ -1,49 +1,129 @@
 #include <stdbool.h>
 #include <stdint.h>
-
-#include <avr/eeprom.h>
+#include <string.h>
 
 #include "nRF24L.h"
 #include "led.h"
+#include "sleeping.h"
+#include "battery.h"
+#include "settings_journal.h"
 #include "ctrl_settings.h"
 
 #define MIN_LED_BRIGHTNESS			1
 #define MAX_LED_BRIGHTNESS			0xfe
 #define DEFAULT_LED_BRIGHTNESS		MIN_LED_BRIGHTNESS
 
-uint8_t EEMEM led_brightness;
-uint8_t EEMEM nrf_output_power;
+#define DEFAULT_DEEP_SLEEP_MINUTES	30
+
+// the OSCCAL for 921.6KHz measured on the first keyboard (see docs/OSCCAL.xls)
+#define DEFAULT_OSCCAL				103
+
+// The settings live in RAM and are read from the EEPROM journal only at boot
+// (see settings_journal.h).
+//
+// set_*() only change the RAM copy; the record is saved SAVE_DELAY_TICKS after
+// the last change, so holding Func+KP- or moving through the menu writes once.
+// The EEPROM write busy-waits, so the timer only sets settings_save_due and the
+// save is done from the idle loop.
+
+#define SAVE_DELAY_TICKS			8192		// 2 sec
+
+settings_record_t settings;
+bool settings_save_due = false;		// set by TIMER_SETTINGS_SAVE
+
+void settings_save_timer(void)
+{
+	settings_save_due = true;
+}
+
+void settings_changed(void)
+{
+	// restart the delay
+	timer_start(TIMER_SETTINGS_SAVE, SAVE_DELAY_TICKS, 0, settings_save_timer);
+}
+
+void save_settings_if_due(void)
+{
+	if (!settings_save_due)
+		return;
+
+	settings_save_due = false;
+	journal_save(&settings);
+}
+
+void init_settings(void)
+{
+	settings_record_t defaults;
+
+	memset(&defaults, 0, sizeof defaults);
+	defaults.version = SETTINGS_VERSION;
+	defaults.size = SETTINGS_SIZE;
+	defaults.led_brightness = DEFAULT_LED_BRIGHTNESS;
+	defaults.nrf_output_power = vRF_PWR_0DBM;
+	defaults.sleep_profile = SLEEP_PROFILE_BALANCED;
+	defaults.deep_sleep_minutes = DEFAULT_DEEP_SLEEP_MINUTES;
+	defaults.osccal = DEFAULT_OSCCAL;
+	defaults.usb_sync = false;
+	defaults.heartbeat = false;
+
+	// the first save starts the journal
+	if (!journal_load(&settings, &defaults))
+		settings = defaults;
+}
 
 uint8_t get_led_brightness(void)
 {
-	uint8_t ret_val = eeprom_read_byte(&led_brightness);
-	if (ret_val > MAX_LED_BRIGHTNESS)	// if not set yet
-		ret_val = DEFAULT_LED_BRIGHTNESS;
+	uint8_t ret_val = settings.led_brightness;
+
+	// save the battery
+	if (get_battery_level() != BATT_LEVEL_OK  &&  ret_val > BATT_LOW_LED_BRIGHTNESS)
+		ret_val = BATT_LOW_LED_BRIGHTNESS;
 
 	return ret_val;
 }
 
 uint8_t get_nrf_output_power(void)
 {
-	uint8_t ret_val = eeprom_read_byte(&nrf_output_power);
-	
-	// default to highest power
-	if (ret_val != vRF_PWR_M18DBM
-			&&  ret_val != vRF_PWR_M12DBM
-			&&  ret_val != vRF_PWR_M6DBM)
-	{
-		ret_val = vRF_PWR_0DBM;
-	}
+	return settings.nrf_output_power;
+}
 
-	return ret_val;
+uint8_t get_sleep_profile(void)
+{
+	return settings.sleep_profile;
+}
+
+uint8_t get_deep_sleep_minutes(void)
+{
+	return settings.deep_sleep_minutes;
+}
+
+uint8_t get_osccal(void)
+{
+	return settings.osccal;
+}
+
+bool get_usb_sync(void)
+{
+	return settings.usb_sync;
+}
+
+bool get_heartbeat(void)
+{
+	return settings.heartbeat;
 }
 
 void set_led_brightness(uint8_t new_val)
 {
-	if (new_val == 0xff)
-		new_val = 0xfe;
+	if (new_val < MIN_LED_BRIGHTNESS)
+		new_val = MIN_LED_BRIGHTNESS;
+	else if (new_val > MAX_LED_BRIGHTNESS)
+		new_val = MAX_LED_BRIGHTNESS;
 
-	eeprom_update_byte(&led_brightness, new_val);
+	if (new_val != settings.led_brightness)
+	{
+		settings.led_brightness = new_val;
+		settings_changed();
+	}
 	
 	init_leds();
 }
@@ -57,5 +137,59 @@ void set_nrf_output_power(uint8_t new_val)
 		new_val = vRF_PWR_0DBM;
 	}
 	
-	eeprom_update_byte(&nrf_output_power, new_val);
+	if (new_val != settings.nrf_output_power)
+	{
+		settings.nrf_output_power = new_val;
+		settings_changed();
+	}
+}
+
+void set_sleep_profile(uint8_t new_val)
+{
+	if (new_val >= NUM_SLEEP_PROFILES)
+		new_val = SLEEP_PROFILE_BALANCED;
+		
+	if (new_val != settings.sleep_profile)
+	{
+		settings.sleep_profile = new_val;
+		settings_changed();
+	}
+	
+	select_sleep_profile(new_val);
+}
+
+void set_deep_sleep_minutes(uint8_t new_val)
+{
+	if (new_val != settings.deep_sleep_minutes)
+	{
+		settings.deep_sleep_minutes = new_val;
+		settings_changed();
+	}
+}
+
+void set_osccal(uint8_t new_val)
+{
+	if (new_val != settings.osccal)
+	{
+		settings.osccal = new_val;
+		settings_changed();
+	}
+}
+
+void set_usb_sync(bool new_val)
+{
+	if (new_val != settings.usb_sync)
+	{
+		settings.usb_sync = new_val;
+		settings_changed();
+	}
+}
+
+void set_heartbeat(bool new_val)
+{
+	if (new_val != settings.heartbeat)
+	{
+		settings.heartbeat = new_val;
+		settings_changed();
+	}
 }
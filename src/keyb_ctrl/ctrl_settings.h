@@ -1,7 +1,31 @@
 #pragma once
 
+// loads the settings from the EEPROM; call before using any of the below
+void init_settings(void);
+
+// saves the settings if they changed a while ago; call from the idle loop
+void save_settings_if_due(void);
+
 uint8_t get_led_brightness(void);
 uint8_t get_nrf_output_power(void);
+uint8_t get_sleep_profile(void);
+
+// the idle time before the deep sleep; 0 is never
+uint8_t get_deep_sleep_minutes(void);
+
+// the last RC oscillator calibration result
+uint8_t get_osccal(void);
+
+// true if the scans are aligned with the USB polls (see usb_sync.h)
+bool get_usb_sync(void);
+
+// true if the keyboard sends the heartbeats (see rf_ctrl.h)
+bool get_heartbeat(void);
 
 void set_led_brightness(uint8_t new_val);
 void set_nrf_output_power(uint8_t new_val);
+void set_sleep_profile(uint8_t new_val);
+void set_deep_sleep_minutes(uint8_t new_val);
+void set_osccal(uint8_t new_val);
+void set_usb_sync(bool new_val);
+void set_heartbeat(bool new_val);
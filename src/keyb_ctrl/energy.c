@@ -0,0 +1,116 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <util/atomic.h>
+
+#include "energy.h"
+#include "sleeping.h"
+
+uint32_t energy_awake_ticks = 0;
+uint32_t energy_fast_ticks = 0;
+uint32_t energy_nrf_ticks = 0;
+uint32_t energy_nrf_power_ups = 0;
+uint32_t energy_tx_attempts[4] = {0, 0, 0, 0};
+uint32_t energy_led_weighted = 0;
+uint32_t energy_scans = 0;
+
+// The charge model. NOT CALIBRATED: these are the typical datasheet currents
+// at 3V, not measurements of the real keyboard.
+#define SLEEP_UA				7			// MCU power save with Timer2, nRF power down and leakage
+#define AWAKE_NC_PER_TICK		98			// MCU at 921.6KHz: 400uA x 244us
+#define FAST_NC_PER_TICK		415			// MCU at 3.6864MHz (clock_fast()): 1.7mA x 244us
+#define NRF_UP_NC_PER_TICK		6			// nRF standby-I: 26uA x 244us
+#define NRF_START_NC			600			// nRF crystal start up: 400uA x 1.5ms
+#define LED_NC_PER_FRAME		39063		// one LED at full duty: 5mA x 7.8125ms
+
+// TX for ~300us (settling + packet) and RX for the 250us ARD while waiting for the ACK (13.5mA)
+// per output power, -18dBm first; in 100nC
+const __flash uint8_t tx_charge_per_attempt[4] =
+{
+	55,		// -18dBm, 7.0mA
+	56,		// -12dBm, 7.5mA
+	61,		//  -6dBm, 9.0mA
+	68,		//   0dBm, 11.3mA
+};
+
+#define NC_PER_UAH				3600000UL
+
+// two AA alkaline cells down to 2.0V
+#define BATTERY_CAPACITY_UAH	2000000UL
+
+// the fast clock time is part of the awake time; it's counted in ticks, so the
+// bursts shorter than a tick are counted as 0 or 1, which is right on average
+bool is_clock_fast = false;
+uint32_t clock_fast_since;
+
+void energy_clock_fast(void)
+{
+	if (is_clock_fast)
+		return;
+
+	is_clock_fast = true;
+	clock_fast_since = get_ticks();
+}
+
+void energy_clock_slow(void)
+{
+	if (!is_clock_fast)
+		return;
+
+	is_clock_fast = false;
+
+	// TCNT2 can read the value from before the sleep right after a wake-up
+	uint32_t ticks = get_ticks() - clock_fast_since;
+	if ((int32_t) ticks > 0)
+		energy_fast_ticks += ticks;
+}
+
+uint32_t energy_get_led_weighted(void)
+{
+	uint32_t ret_val;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		ret_val = energy_led_weighted;
+	}
+
+	return ret_val;
+}
+
+uint32_t energy_get_used_uah(void)
+{
+	uint32_t ret_val = get_seconds32() * SLEEP_UA / 3600;
+	
+	ret_val += energy_awake_ticks / (NC_PER_UAH / AWAKE_NC_PER_TICK);
+	ret_val += energy_fast_ticks / (NC_PER_UAH / (FAST_NC_PER_TICK - AWAKE_NC_PER_TICK));
+	ret_val += energy_nrf_ticks / (NC_PER_UAH / NRF_UP_NC_PER_TICK);
+	ret_val += energy_nrf_power_ups / (NC_PER_UAH / NRF_START_NC);
+	ret_val += (energy_get_led_weighted() >> 8) / (NC_PER_UAH / LED_NC_PER_FRAME);
+	
+	uint8_t level;
+	for (level = 0; level < 4; ++level)
+		ret_val += energy_tx_attempts[level] / (NC_PER_UAH / 100 / tx_charge_per_attempt[level]);
+	
+	return ret_val;
+}
+
+uint16_t energy_get_hours_left(void)
+{
+	uint32_t hours_on = get_seconds32() / 3600;
+	uint32_t used_uah = energy_get_used_uah();
+
+	if (hours_on == 0  ||  used_uah == 0)
+		return 0xffff;
+
+	if (used_uah >= BATTERY_CAPACITY_UAH)
+		return 0;
+		
+	// the average current since power up in uA
+	uint32_t avg_ua = used_uah / hours_on;
+	if (avg_ua == 0)
+		avg_ua = 1;
+		
+	uint32_t ret_val = (BATTERY_CAPACITY_UAH - used_uah) / avg_ua;
+
+	return ret_val < 0xfffe ? ret_val : 0xfffe;
+}
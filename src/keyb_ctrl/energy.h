@@ -0,0 +1,28 @@
+#pragma once
+
+// energy accounting counters; they start from 0 at power up
+extern uint32_t energy_awake_ticks;			// MCU awake time in 244us ticks
+extern uint32_t energy_fast_ticks;			// the part of it on the fast clock (see clock.h)
+extern uint32_t energy_nrf_ticks;			// nRF powered up, in 244us ticks
+extern uint32_t energy_nrf_power_ups;		// nRF power ups from power down
+extern uint32_t energy_tx_attempts[4];		// TX attempts with the auto retransmits, per output power (-18dBm first)
+extern uint32_t energy_led_weighted;		// 7.8ms LED PWM frames x the lit LEDs x the duty cycle (0-255)
+extern uint32_t energy_scans;				// matrix scans
+
+// Keeping the nRF in standby-I (26uA) for longer than this costs more than
+// powering it down and starting the crystal again (400uA for 1.5ms); ~23ms
+#define NRF_BREAK_EVEN_TICKS		94
+
+// clock_fast() and clock_slow() call these
+void energy_clock_fast(void);
+void energy_clock_slow(void);
+
+// returns energy_led_weighted; the Timer2 interrupt adds to it, so read it through this
+uint32_t energy_get_led_weighted(void);
+
+// returns the charge drawn from the battery since power up in uAh
+uint32_t energy_get_used_uah(void);
+
+// returns the estimated battery life left in hours
+// based on the average current since power up; 0xffff if it's too early to tell
+uint16_t energy_get_hours_left(void);
@@ -6,25 +6,34 @@
 
 #include "hw_setup.h"
 #include "led.h"
+#include "sleeping.h"
+#include "energy.h"
 #include "avrutils.h"
 #include "ctrl_settings.h"
 
 #define USER_BRIGHTNESS		0xff
 
+// The LED PWM runs on the Timer2 compare unit. Timer2 is clocked by the 32KHz crystal
+// and keeps running in power save, so the MCU sleeps while the LEDs are on.
+// sleeping.c switches the Timer2 to no prescaler while the LEDs are on; the overflow
+// (7.8125ms) turns the LEDs on, and the compare match turns them off.
+#define LED_FRAMES_PER_CYCLE	2		// Timer2 overflows per LED cycle, 15.625ms
+
+volatile bool leds_running = false;
 volatile uint8_t curr_led_status = 0;
 volatile uint8_t cycle_counter;		// duration the LEDs are on
+uint8_t frame_counter;
 const __flash led_sequence_t* sequence = 0;
 
+uint8_t led_pwm;					// the duty cycle in OCR2A
+volatile uint8_t led_pwm_next;		// the duty cycle of the next frame
+
 void turn_on_leds(void)
 {
 	// turn the needed LEDs on by setting
 	// the DDR to output and driving the pin(s) low
 	DDRG = curr_led_status;
 	PORTG = ~curr_led_status;
-	
-	// change the PWM duty cycle?
-	if (sequence)
-		OCR0A += sequence->pwm_delta;
 }
 
 void turn_off_leds(void)
@@ -34,22 +43,24 @@ void turn_off_leds(void)
 	PORTG = 0xff;	// all pullups
 }
 
-// Timer0 interrupts are used for LED brightness with software PWM
-ISR(TIMER0_OVF_vect)
+void stop_led_pwm(void)
 {
-	turn_on_leds();
+	leds_running = false;
+	TIMSK2 &= ~_BV(OCIE2A);
+	turn_off_leds();
 }
 
-ISR(TIMER0_COMP_vect)
+void next_led_cycle(void)
 {
-	turn_off_leds();
-	
+	// change the PWM duty cycle?
+	if (sequence)
+		led_pwm_next += sequence->pwm_delta;
+
 	if (--cycle_counter == 0)
 	{
 		if (sequence == 0)
 		{
-			// stop the timer
-			TCCR0A = 0;
+			stop_led_pwm();
 		} else {
 			++sequence;
 			
@@ -57,30 +68,76 @@ ISR(TIMER0_COMP_vect)
 			
 			if (num_cycles == 0)
 			{
-				// stop the timer
-				TCCR0A = 0;
+				stop_led_pwm();
 				
 				// stop the sequence iterator
 				sequence = 0;
 			} else {
 				curr_led_status = sequence->led_status & 0x07;
 				cycle_counter = num_cycles;
-				OCR0A = sequence->brightness == USER_BRIGHTNESS ? get_led_brightness() : sequence->brightness;
+				led_pwm_next = sequence->brightness == USER_BRIGHTNESS ? get_led_brightness() : sequence->brightness;
 			}
 		}
 	}
 }
 
+// called from the Timer2 overflow interrupt while Timer2 runs without the prescaler
+void led_pwm_frame(void)
+{
+	if (!leds_running)
+		return;
+		
+	if (++frame_counter == LED_FRAMES_PER_CYCLE)
+	{
+		frame_counter = 0;
+		next_led_cycle();
+		
+		if (!leds_running)
+			return;
+	}
+
+	if (led_pwm)
+	{
+		turn_on_leds();
+		
+		// the lit LEDs weighted by the duty cycle
+		uint8_t status = curr_led_status;
+		energy_led_weighted += led_pwm * ((status & 1) + ((status >> 1) & 1) + ((status >> 2) & 1));
+	}
+}
+
+ISR(TIMER2_COMP_vect)
+{
+	turn_off_leds();
+	
+	// The new duty cycle takes effect in the next frame. OCR2A is updated asynchronously,
+	// and writing it here, away from the overflow, makes sure the update is done
+	// before the counter gets to the new value.
+	if (led_pwm != led_pwm_next)
+		OCR2A = led_pwm = led_pwm_next;
+}
+
 void init_leds(void)
 {
-	// timer interrupts for compare and overflow
-	TIMSK0 = _B1(OCIE0A) | _B1(TOIE0);
+	turn_off_leds();
 }
 
-void start_led_timer(void)
+void start_led_pwm(void)
 {
-	// start the timer
-	TCCR0A = _BV(CS01) | _BV(CS00);		// normal mode, prescaler 64
+	if (leds_running)
+		return;
+
+	timer2_fast();
+	
+	// the LEDs are turned on with the next overflow
+	loop_until_bit_is_clear(ASSR, OCR2UB);
+	OCR2A = led_pwm = led_pwm_next;
+	frame_counter = 0;
+	
+	TIFR2 = _BV(OCF2A);
+	TIMSK2 |= _BV(OCIE2A);
+	
+	leds_running = true;
 }
 
 void set_leds(uint8_t new_led_status, uint8_t num_cycles)
@@ -95,23 +152,14 @@ void set_leds(uint8_t new_led_status, uint8_t num_cycles)
 	cycle_counter = num_cycles;
 
 	// reset the PWM duty cycle
-	OCR0A = get_led_brightness();
-	
-	// is the timer off?
-	if (TCCR0A == 0)
-	{
-		// reset the counter
-		TCNT0 = 0;
+	led_pwm_next = get_led_brightness();
 
-		turn_on_leds();
-		
-		start_led_timer();
-	}
+	start_led_pwm();
 }
 
 bool are_leds_on(void)
 {
-	return TCCR0A != 0;
+	return leds_running;
 }
 
 void start_led_sequence(const __flash led_sequence_t* seq)
@@ -119,7 +167,7 @@ void start_led_sequence(const __flash led_sequence_t* seq)
 	sequence = seq;
 	
 	// init the PWM duty cycle
-	OCR0A = sequence->brightness == USER_BRIGHTNESS ? get_led_brightness() : sequence->brightness;
+	led_pwm_next = sequence->brightness == USER_BRIGHTNESS ? get_led_brightness() : sequence->brightness;
 
 	// set the status
 	curr_led_status = seq->led_status;
@@ -127,16 +175,7 @@ void start_led_sequence(const __flash led_sequence_t* seq)
 	// init the cycle counter
 	cycle_counter = seq->num_cycles;
 
-	// is the timer off?
-	if (TCCR0A == 0)
-	{
-		// reset the counter
-		TCNT0 = 0;
-
-		turn_on_leds();
-
-		start_led_timer();
-	}
+	start_led_pwm();
 }
 
 
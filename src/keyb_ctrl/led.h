@@ -1,15 +1,18 @@
 #pragma once
 
-// initializes the Timer0 interrupt
+// turns the LEDs off
 void init_leds(void);
 
-// initializes the Timer0 used for LED PWM
-// and turns on the selected LEDs
+// starts the LED PWM on Timer2
+// and turns on the selected LEDs for num_cycles of 15.6ms
 void set_leds(uint8_t new_led_status, uint8_t num_cycles);
 
-// returns true if the PWM counter is running
+// returns true if the LED PWM is running
 bool are_leds_on(void);
 
+// steps the LED PWM; called from the Timer2 overflow interrupt
+void led_pwm_frame(void);
+
 
 typedef struct 
 {
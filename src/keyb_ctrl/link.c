@@ -0,0 +1,63 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "link.h"
+
+bool is_link_up = true;
+uint32_t next_probe;
+uint16_t probe_interval;
+uint32_t last_activity = 0;
+uint8_t link_losses = 0;
+
+void link_result(uint32_t now, bool acked)
+{
+	if (acked)
+	{
+		is_link_up = true;
+		return;
+	}
+
+	if (is_link_up)
+	{
+		// just lost it; the first ping is soon
+		is_link_up = false;
+		++link_losses;
+		probe_interval = LINK_PROBE_MIN_TICKS;
+	} else if (now - last_activity < LINK_ACTIVE_TICKS) {
+		// somebody is waiting, keep the pings coming
+		probe_interval = LINK_PROBE_MIN_TICKS;
+	} else if (probe_interval < LINK_PROBE_MAX_TICKS / 2) {
+		probe_interval *= 2;
+	} else {
+		probe_interval = LINK_PROBE_MAX_TICKS;
+	}
+
+	next_probe = now + probe_interval;
+}
+
+bool link_is_up(void)
+{
+	return is_link_up;
+}
+
+void link_activity(uint32_t now)
+{
+	last_activity = now;
+
+	// ping now, and start the back off over
+	if (!is_link_up)
+	{
+		probe_interval = LINK_PROBE_MIN_TICKS;
+		next_probe = now;
+	}
+}
+
+bool link_probe_due(uint32_t now)
+{
+	return !is_link_up  &&  (int32_t)(now - next_probe) >= 0;
+}
+
+uint8_t link_get_losses(void)
+{
+	return link_losses;
+}
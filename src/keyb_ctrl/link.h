@@ -0,0 +1,32 @@
+#pragma once
+
+// The link state. rf_ctrl tells us the result of every packet. When a packet
+// is not ACKed after all its attempts the link is lost, and instead of sending
+// the queued messages rf_ctrl probes for the dongle with short pings. The pings
+// back off from LINK_PROBE_MIN_TICKS to LINK_PROBE_MAX_TICKS, so a short outage
+// is over quickly and an absent dongle costs little. The first ACK brings the
+// link back up.
+//
+// The back off is only for the idle time. A new key state, or anything else
+// waiting on the link, calls link_activity(); the next ping goes out right away,
+// and for LINK_ACTIVE_TICKS after that the pings keep LINK_PROBE_MIN_TICKS apart.
+//
+// There's no AVR specific code in here; the host link benchmark uses it too.
+
+#define LINK_PROBE_MIN_TICKS	205			// 50ms
+#define LINK_PROBE_MAX_TICKS	4096		// 1 sec
+#define LINK_ACTIVE_TICKS		8192		// 2 sec
+
+// call after every packet; now is in 244us ticks
+void link_result(uint32_t now, bool acked);
+
+bool link_is_up(void);
+
+// call when something is waiting on the link
+void link_activity(uint32_t now);
+
+// returns true if it's time for the next ping; only while the link is lost
+bool link_probe_due(uint32_t now);
+
+// the number of times the link was lost; wraps around
+uint8_t link_get_losses(void);
@@ -6,6 +6,8 @@
 
 #include "matrix.h"
 #include "keycode.h"
+#include "clock.h"
+#include "energy.h"
 
 const __flash uint8_t matrix2keycode[NUM_ROWS][NUM_COLS] = 
 {
@@ -44,12 +46,15 @@ bool matrix_scan(void)
 	uint8_t row, col;
 
 	matrix_num_keys_pressed = 0;	// no keys are pressed
+	++energy_scans;
+	
+	clock_fast();
 	
 	// config ports D and A as outputs and drive them low
 	DDRD = 0xff;	PORTD = 0x00;
 	DDRA = 0xff;	PORTA = 0x00;
 
-	_delay_us(3);	// wait a little for the levels to stabilize
+	delay_us_fast(3);	// wait a little for the levels to stabilize
 	
 	// first we want to know if any keys are pressed.
 	// most of the time no key will be pressed,
@@ -80,7 +85,7 @@ bool matrix_scan(void)
 				PORTA = 0xff, PORTD = ~_BV(row - 8);
 
 			// we have to wait a little for the levels to stabilize
-			_delay_us(3);
+			delay_us_fast(3);
 			
 			// sample the inputs
 			uint8_t cols = ~PINC;
@@ -110,9 +115,28 @@ bool matrix_scan(void)
 	DDRD = 0x00;	PORTD = 0xff;
 	DDRA = 0x00;	PORTA = 0xff;
 	
+	clock_slow();
+
 	return has_changes;
 }
 
+bool matrix_probe_rows(uint16_t row_mask)
+{
+	// drive only the selected rows low
+	DDRA = row_mask;		PORTA = ~row_mask;
+	DDRD = row_mask >> 8;	PORTD = ~(row_mask >> 8);
+
+	_delay_us(3);	// wait a little for the levels to stabilize
+
+	bool ret_val = PINC != 0xff;
+	
+	// back to inputs with pull-ups
+	DDRD = 0x00;	PORTD = 0xff;
+	DDRA = 0x00;	PORTA = 0xff;
+
+	return ret_val;
+}
+
 uint8_t get_keycode(uint8_t row, uint8_t col)
 {
 	uint8_t ret_val = matrix2keycode[row][col];
@@ -364,6 +388,11 @@ const __flash keycode2matrix_t keycode2matrix[0xe8] =
 	{ 4, 0x02},		// 0xe7  KC_RGUI
 };
 
+uint16_t get_keycode_row_mask(uint8_t keycode)
+{
+	return (uint16_t) 1 << keycode2matrix[keycode].row;
+}
+
 bool is_pressed_keycode(uint8_t keycode)
 {
 	uint8_t row, mask;
@@ -10,9 +10,16 @@ extern uint8_t matrix[NUM_ROWS];
 void matrix_init(void);
 bool matrix_scan(void);
 
+// a quick look at the selected rows (bit 0 is row 0) without updating the matrix
+// returns true if any key in those rows is pressed
+bool matrix_probe_rows(uint16_t row_mask);
+
 // returns the keycode of the key at a position on the matrix
 uint8_t get_keycode(uint8_t row, uint8_t col);
 
+// returns the row mask for matrix_probe_rows() of the key with the given keycode
+uint16_t get_keycode_row_mask(uint8_t keycode);
+
 // checks if the key with the given keycode is pressed
 bool is_pressed_keycode(uint8_t keycode);
 
@@ -0,0 +1,170 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <avr/io.h>
+#include <avr/power.h>
+#include <avr/interrupt.h>
+
+#include "osccal.h"
+#include "led.h"
+#include "sleeping.h"
+#include "ctrl_settings.h"
+
+// We count the CPU cycles with Timer1 during 32 ticks of Timer2 (7.8125ms).
+// This does not change the Timer2 prescaler, so the watch keeps going, but Timer2
+// has to be back on the 244us ticks after the LEDs.
+#define CALIB_TIMER2_TICKS		32
+#define CALIB_CPU_CYCLES		(F_CPU / (32768 / 8) * CALIB_TIMER2_TICKS)		// 7200 at 921.6KHz
+
+// a result further off than this is a bad measurement, not a bad OSCCAL
+#define CALIB_MAX_ERROR			(CALIB_CPU_CYCLES / 4)
+
+#define MAX_OSCCAL				0x7f
+#define CALIB_PERIOD_SEC		600		// recalibrate every 10 minutes
+#define CALIB_IDLE_SEC			10		// only after the keyboard has been idle this long
+
+uint16_t last_calibration = 0;
+
+uint16_t measure_cpu_cycles(void)
+{
+	uint16_t ret_val;
+	uint8_t start;
+	
+	power_timer1_enable();
+	TCCR1A = 0;
+	TCCR1B = 0;
+
+	// the interrupts would delay the polling
+	cli();
+	
+	// start on the edge of a Timer2 tick
+	start = TCNT2;
+	while (TCNT2 == start)
+		;
+	
+	TCNT1 = 0;
+	TCCR1B = _BV(CS10);		// no prescaler
+	
+	++start;
+	while ((uint8_t)(TCNT2 - start) < CALIB_TIMER2_TICKS)
+		;
+		
+	TCCR1B = 0;
+	ret_val = TCNT1;
+	
+	sei();
+	
+	power_timer1_disable();
+	
+	return ret_val;
+}
+
+// The walk is split over the idle wake-ups: each call does as many steps as
+// fit before TCNT2 overflows. In the slow mode TCNT2 counts the time we've been
+// awake since the last sleep, and an overflow would be lost from the watch.
+bool walk_active = false;
+uint8_t walk_start_osccal;
+uint8_t walk_best_osccal;
+uint8_t walk_next_osccal;			// the OSCCAL to measure on the next call
+uint16_t walk_best_diff;
+
+void walk_start(void)
+{
+	walk_start_osccal = OSCCAL;
+	walk_best_osccal = OSCCAL;
+	walk_next_osccal = OSCCAL;
+	walk_best_diff = 0xffff;
+	walk_active = true;
+}
+
+void walk_finish(void)
+{
+	walk_active = false;
+	last_calibration = get_seconds();
+	
+	// something went wrong with the measurement; keep the old value
+	if (walk_best_diff > CALIB_MAX_ERROR)
+	{
+		OSCCAL = walk_start_osccal;
+		return;
+	}
+	
+	OSCCAL = walk_best_osccal;
+	
+	// remember it for the next power up
+	set_osccal(walk_best_osccal);
+}
+
+void walk_steps(void)
+{
+	// Timer2 runs faster while the LEDs are on
+	if (are_leds_on())
+		return;
+
+	// the LEDs have gone off, but Timer2 is still fast until the next sleep
+	timer2_slow();
+
+	uint16_t cycles, diff;
+
+	OSCCAL = walk_next_osccal;
+	
+	// the frequency grows with OSCCAL, so we walk towards the target one step
+	// at a time until the error stops getting smaller
+	while (TCNT2 < 0xff - CALIB_TIMER2_TICKS - 2)
+	{
+		cycles = measure_cpu_cycles();
+		diff = cycles > CALIB_CPU_CYCLES ? cycles - CALIB_CPU_CYCLES : CALIB_CPU_CYCLES - cycles;
+		
+		// don't walk OSCCAL off to the end of its range on a bad measurement
+		if (diff > CALIB_MAX_ERROR  ||  diff >= walk_best_diff)
+		{
+			walk_finish();
+			return;
+		}
+		
+		walk_best_diff = diff;
+		walk_best_osccal = OSCCAL;
+		
+		if (cycles > CALIB_CPU_CYCLES  &&  OSCCAL > 0)
+		{
+			--OSCCAL;
+		} else if (cycles < CALIB_CPU_CYCLES  &&  OSCCAL < MAX_OSCCAL) {
+			++OSCCAL;
+		} else {
+			walk_finish();
+			return;
+		}
+	}
+	
+	// not done; run on the best value so far until the next call
+	walk_next_osccal = OSCCAL;
+	OSCCAL = walk_best_osccal;
+}
+
+void osccal_calibrate(void)
+{
+	walk_start();
+	while (walk_active)
+	{
+		walk_steps();
+		if (walk_active)
+			sleep_ticks(1);
+	}
+}
+
+void osccal_calibrate_if_due(uint16_t idle_sec)
+{
+	// the measurement runs with the interrupts off, so not while typing
+	if (idle_sec < CALIB_IDLE_SEC)
+		return;
+		
+	if (!walk_active)
+	{
+		if (get_seconds() - last_calibration < CALIB_PERIOD_SEC)
+			return;
+			
+		walk_start();
+	}
+	
+	walk_steps();
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+// calibrates the RC oscillator to F_CPU against the 32KHz crystal on Timer2
+// takes about 8ms per OSCCAL step, starting from the current OSCCAL
+void osccal_calibrate(void);
+
+// runs the calibration if the last one was long enough ago and the keyboard
+// has been idle for idle_sec; a long walk is continued on the next calls
+void osccal_calibrate_if_due(uint16_t idle_sec);
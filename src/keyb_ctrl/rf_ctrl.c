@@ -13,6 +13,12 @@
 #include "led.h"
 #include "sleeping.h"
 #include "ctrl_settings.h"
+#include "text_dict.h"
+#include "clock.h"
+#include "energy.h"
+#include "battery.h"
+#include "usb_sync.h"
+#include "link.h"
 
 // plugging in AVR Dragon's ISP cable will cause the nRF module check to fail,
 // even if the nRF works without problems.
@@ -22,6 +28,146 @@
 // we want to count the lost packets
 uint32_t plos_total, arc_total, rf_packets_total;
 
+// The outgoing message queue.
+// The messages have one slot per priority, and a newer message replaces the one
+// still waiting in the slot. The text is queued as chars and dictionary
+// tokens, and goes out in chunks only when no other message is waiting.
+typedef struct
+{
+	uint8_t		len;		// 0 if the slot is empty
+	uint8_t		data[32];
+} rf_queue_slot_t;
+
+rf_queue_slot_t rf_queue[RF_PRIO_TEXT];
+
+#define TEXT_QUEUE_SIZE		128		// has to be a power of two
+#define TEXT_QUEUE_MASK		(TEXT_QUEUE_SIZE - 1)
+
+uint8_t text_queue[TEXT_QUEUE_SIZE];
+uint8_t text_queue_head = 0;		// free running, masked only when indexing
+uint8_t text_queue_tail = 0;
+
+rf_msg_text_t text_chunk;			// the chunk of text we are trying to send
+uint8_t text_chunk_len = 0;			// 0 if there is no chunk
+uint8_t text_chunk_expanded;		// the number of chars the chunk expands to on the dongle
+
+// this message id is used to avoid presenting the same package to the dongle in case dongle
+// received the message, but the keyboard did not receive the ACK
+uint8_t text_msg_id = 1;
+
+uint16_t dongle_text_free;			// the last free space of the text buffer the dongle has told us about
+bool dongle_text_free_valid = false;	// true if dongle_text_free is up to date for text_chunk
+
+// The shadows of the nRF registers that change at run time. The writes that
+// would not change the register are skipped; 0xff means we don't know.
+uint8_t nrf_config = 0xff;
+uint8_t nrf_rf_setup = 0xff;
+uint8_t nrf_setup_retr = 0xff;
+
+// The nRF shifts out STATUS with the command byte of every transaction, and the
+// driver leaves it in nRF_data[0]. We keep the one from the last transaction
+// instead of asking for it again with NOP.
+uint8_t nrf_status;
+bool nrf_status_valid = false;
+
+// when the nRF was last powered up; see rf_ctrl_power_down()
+uint32_t nrf_powered_up;
+
+// the power down is SPI, so TIMER_NRF_POWER_DOWN only sets this and
+// rf_ctrl_power_down_if_due() does it from the idle loop
+bool nrf_power_down_due = false;
+
+// The timing beacon in an ACK is about the key state message sent before the packet
+// the ACK is for; these remember when that was (see usb_sync.h)
+uint32_t key_state_sent_tick;
+bool key_state_was_up;
+uint32_t beacon_ref_tick;
+bool beacon_ref_was_up;
+
+// a packet that was not ACKed stays in the TX FIFO
+bool nrf_tx_fifo_dirty = true;
+
+// the last key state; it's sent again after the link comes back, because the
+// dongle has released the keys by then (see LINK_TIMEOUT_MS)
+rf_msg_key_state_report_t last_key_state;
+uint8_t last_key_state_len = 0;
+bool key_state_resend_due = false;
+
+// the keep-alives while the keys are down, see LINK_TIMEOUT_MS
+#define KEEP_ALIVE_TICKS		(KEEP_ALIVE_MS * 4096UL / 1000)
+bool keep_alive_due = false;			// set by TIMER_KEEP_ALIVE
+
+// The heartbeat tells the dongle the battery and link health, and its ACK brings
+// the LED status the host has changed since our last packet. It goes out when
+// nothing else is waiting, every get_heartbeat_ticks(), so it follows the sleep
+// schedule and costs about the same share of the battery in any period.
+uint32_t last_heartbeat = 0;
+
+// the attempts of a message before the link is lost (see link.h)
+#define LINK_LOSS_ATTEMPTS		12
+
+// the ping while the link is lost: one attempt with a few auto retransmits
+#define PROBE_ARC				3
+
+// RX_P_NO in STATUS is 111 if the RX FIFO is empty
+#define STATUS_RX_P_NO_MASK		0x0e
+
+void write_config(uint8_t val)
+{
+	if (val != nrf_config)
+	{
+		nRF_WriteReg(CONFIG, val);
+		nrf_config = val;
+		nrf_status = nRF_data[0];
+		nrf_status_valid = true;
+	}
+}
+
+void write_rf_setup(uint8_t val)
+{
+	if (val != nrf_rf_setup)
+	{
+		nRF_WriteReg(RF_SETUP, val);
+		nrf_rf_setup = val;
+		nrf_status = nRF_data[0];
+		nrf_status_valid = true;
+	}
+}
+
+void write_setup_retr(uint8_t val)
+{
+	if (val != nrf_setup_retr)
+	{
+		nRF_WriteReg(SETUP_RETR, val);
+		nrf_setup_retr = val;
+		nrf_status = nRF_data[0];
+		nrf_status_valid = true;
+	}
+}
+
+void rf_ctrl_power_down(void)
+{
+	if (nrf_config & vPWR_UP)
+	{
+		write_config(vEN_CRC | vCRCO);		// nRF power down
+		energy_nrf_ticks += get_ticks() - nrf_powered_up;
+	}
+	
+	timer_stop(TIMER_NRF_POWER_DOWN);
+	nrf_power_down_due = false;
+}
+
+void nrf_power_down_timer(void)
+{
+	nrf_power_down_due = true;
+}
+
+void rf_ctrl_power_down_if_due(void)
+{
+	if (nrf_power_down_due)
+		rf_ctrl_power_down();
+}
+
 void rf_ctrl_init(void)
 {
 	nRF_Init();
@@ -65,8 +211,9 @@ void rf_ctrl_init(void)
 	nRF_WriteReg(EN_AA, vENAA_P0);			// enable auto acknowledge
 	nRF_WriteReg(EN_RXADDR, vERX_P0);		// enable RX address (for ACK)
 	
-	nRF_WriteReg(SETUP_RETR, vARD_250us 	// auto retransmit delay - ARD
-							| 0x0f);		// auto retransmit count - ARC
+	nrf_setup_retr = 0xff;
+	write_setup_retr(vARD_250us 	// auto retransmit delay - ARD
+					| 0x0f);		// auto retransmit count - ARC
 	nRF_WriteReg(FEATURE, vEN_DPL | vEN_ACK_PAY);	// enable dynamic payload length and ACK payload
 	nRF_WriteReg(DYNPD, vDPL_P0);					// enable dynamic payload length for pipe 0
 
@@ -76,101 +223,230 @@ void rf_ctrl_init(void)
 	nRF_WriteReg(STATUS, vRX_DR | vTX_DS | vMAX_RT);	// reset the IRQ flags
 	nRF_WriteReg(RF_CH, CHANNEL_NUM);					// set the channel
 	
+	nrf_config = nrf_rf_setup = 0xff;
+	write_config(vEN_CRC | vCRCO);						// powered down
+	nrf_tx_fifo_dirty = false;
+	
 	// reset the the lost packet counters
 	plos_total = arc_total = rf_packets_total = 0;
 }
 
-bool rf_ctrl_send_message(const void* buff, const uint8_t num_bytes)
+// gets the nRF ready for the next packet; leaves the MCU on the fast clock
+// returns true if the nRF was already powered up
+bool prepare_tx(uint8_t output_power)
 {
-	nRF_WriteReg(RF_SETUP, vRF_DR_2MBPS			// data rate 
-							| get_nrf_output_power());	// output power
+	clock_fast();
+	
+	// don't let the hold timer power down the nRF while we use it
+	timer_stop(TIMER_NRF_POWER_DOWN);
+	nrf_power_down_due = false;
+
+	write_rf_setup(vRF_DR_2MBPS			// data rate 
+					| output_power);	// output power
+
+	// the FIFO is empty after an ACKed packet
+	if (nrf_tx_fifo_dirty)
+	{
+		nRF_FlushTX();
+		nrf_tx_fifo_dirty = false;
+	}
+	
+	// The nRF stays in standby-I for a while after a packet, so during a burst of
+	// typing the packet goes out after the 130us TX settling instead of the 1.5ms
+	// crystal start up.
+	bool was_powered_up = (nrf_config & vPWR_UP) != 0;
+
+	if (!was_powered_up)
+	{
+		write_config(vEN_CRC | vCRCO | vPWR_UP);	// power up
+		nrf_powered_up = get_ticks();
+		++energy_nrf_power_ups;
+	}
+
+	// the flags are cleared after every packet, so this is only needed if
+	// something else has set them
+	if (!nrf_status_valid  ||  (nrf_status & (vTX_DS | vRX_DR | vMAX_RT)))
+	{
+		nRF_WriteReg(STATUS, vTX_DS | vRX_DR | vMAX_RT);	// reset the status flag
+		nrf_status = nRF_data[0] & ~(vTX_DS | vRX_DR | vMAX_RT);
+		nrf_status_valid = true;
+	}
+
+	return was_powered_up;
+}
+
+// sends the packet with up to max_attempts of arc_max auto retransmits each
+// runs the SPI on the fast clock, and returns with the slow clock
+bool send_packet(const void* buff, const uint8_t num_bytes, uint8_t max_attempts, uint8_t arc_max)
+{
+	uint32_t sent_tick = get_ticks();
+	uint8_t output_power = get_nrf_output_power();
+	bool was_powered_up = prepare_tx(output_power);
+
+	write_setup_retr(vARD_250us | arc_max);
+
+	beacon_ref_tick = key_state_sent_tick;
+	beacon_ref_was_up = key_state_was_up;
+	if (((const uint8_t*) buff)[0] == MT_KEY_STATE)
+	{
+		key_state_sent_tick = sent_tick;
+		key_state_was_up = was_powered_up;
+	}
 
-	nRF_FlushTX();
-	nRF_WriteReg(CONFIG, vEN_CRC | vCRCO | vPWR_UP);	// power up
-	nRF_WriteReg(STATUS, vTX_DS | vRX_DR | vMAX_RT);	// reset the status flag
 	nRF_WriteTxPayload(buff, num_bytes);
 	
 	bool is_sent;
 
 	uint8_t attempts = 0;
-	const uint8_t MAX_ATTEMPTS = 45;
 
 	uint8_t ticks = 15;
 	const uint8_t TICKS_INCREMENT = 20;
+	uint8_t arc;
 	
 	do {
 		nRF_CE_hi();	// signal the transceiver to send the packet
 
-		// wait for the nRF to signal an event
-		sleep_ticks(3);
+		// sleep until the nRF signals an event
+		clock_slow();
 		while (PIN(NRF_IRQ_PORT) & _BV(NRF_IRQ_BIT))
-			sleep_ticks(1);
+			sleep_until_nrf_irq(0xf0);
 
+		clock_fast();
 		nRF_CE_lo();
 
-		uint8_t status = nRF_NOP();			// read the status reg
+		// reset the status flags; the status before the reset comes back with the command
+		nRF_WriteReg(STATUS, vMAX_RT | vTX_DS | vRX_DR);
+		uint8_t status = nRF_data[0];
 		is_sent = (status & vTX_DS) != 0;	// did we get an ACK?
 
-		nRF_WriteReg(STATUS, vMAX_RT | vTX_DS | vRX_DR);	// reset the status flags
+		// the flags are clear now, RX_P_NO is still good
+		nrf_status = status & ~(vMAX_RT | vTX_DS | vRX_DR);
+		nrf_status_valid = true;
+
+		// read the ARC; MAX_RT means all the retransmits were used
+		if (is_sent)
+		{
+			nRF_ReadReg(OBSERVE_TX);
+			arc = nRF_data[1] & 0x0f;
+		} else {
+			arc = arc_max;
+		}
+		
+		arc_total += arc;
 		
-		// read the ARC
-		nRF_ReadReg(OBSERVE_TX);
-		arc_total += nRF_data[1] & 0x0f;
+		// the RF_PWR bits are 2:1 in RF_SETUP
+		energy_tx_attempts[(output_power >> 1) & 0x03] += 1 + arc;
 		
 		++rf_packets_total;
+		++attempts;
 		
 		if (!is_sent)
 		{
 			++plos_total;
-			nRF_ReuseTxPayload();		// send the last message again
-			
-			if (ticks >= 0xfe - TICKS_INCREMENT)
+
+			// back off, unless that was the last attempt
+			if (attempts < max_attempts)
 			{
-				sleep_max(5);		// 63ms*5 == 0.315sec
-			} else {
-				sleep_ticks(ticks);
-				ticks += TICKS_INCREMENT;
+				nRF_ReuseTxPayload();		// send the last message again
+				
+				clock_slow();
+				if (ticks >= 0xfe - TICKS_INCREMENT)
+				{
+					sleep_max(5);		// 63ms*5 == 0.315sec
+				} else {
+					sleep_ticks(ticks);
+					ticks += TICKS_INCREMENT;
+				}
 			}
 		}
 
-		++attempts;
-
-	} while (!is_sent  &&  attempts < MAX_ATTEMPTS);
+		clock_fast();
+		
+	} while (!is_sent  &&  attempts < max_attempts);
 
-	nRF_WriteReg(CONFIG, vEN_CRC | vCRCO);		// nRF power down
+	nrf_tx_fifo_dirty = !is_sent;
+	
+	clock_slow();
+	
+	// power down after the hold time, unless there's another packet before that
+	timer_start(TIMER_NRF_POWER_DOWN, get_nrf_hold_ticks(), 0, nrf_power_down_timer);
 	
 	return is_sent;
 }
 
-uint8_t rf_ctrl_read_ack_payload(void* buff, const uint8_t buff_size)
+bool rf_ctrl_send_message(const void* buff, const uint8_t num_bytes)
+{
+	uint8_t max_attempts = get_battery_level() == BATT_LEVEL_CRITICAL ? BATT_CRITICAL_RF_ATTEMPTS : LINK_LOSS_ATTEMPTS;
+	bool is_sent = send_packet(buff, num_bytes, max_attempts, 0x0f);
+
+	link_result(get_ticks(), is_sent);
+
+	return is_sent;
+}
+
+// pings the dongle while the link is lost; returns true if it answered
+bool send_probe(void)
+{
+	uint8_t msg_type = MT_KEEP_ALIVE;		// the dongle only notes that it heard us
+	bool is_sent = send_packet(&msg_type, 1, 1, PROBE_ARC);
+
+	link_result(get_ticks(), is_sent);
+
+	return is_sent;
+}
+
+// returns the next ACK payload in the driver's buffer without copying it, or NULL
+// it's valid until the next nRF call
+const uint8_t* read_ack_payload_direct(uint8_t* ack_bytes)
 {
-	uint8_t ret_val = 0;
+	const uint8_t* ret_val = NULL;
 
-	nRF_ReadReg(FIFO_STATUS);
-	uint8_t fifo_status = nRF_data[1];
+	clock_fast();
+	
+	// the status from the last transaction tells us if there's anything in the RX FIFO
+	if (!nrf_status_valid)
+		nrf_status = nRF_NOP();
 
-	if ((fifo_status & vRX_EMPTY) == 0)
+	if ((nrf_status & STATUS_RX_P_NO_MASK) != STATUS_RX_P_NO_MASK)
 	{
+		// the STATUS from these is from before the read
+		nrf_status_valid = false;
+		
 		nRF_ReadRxPayloadWidth();
-		uint8_t ack_bytes = nRF_data[1];
+		*ack_bytes = nRF_data[1];
 
 		// the max ACK payload size has to be 2
-		if (ack_bytes <= 32)
+		if (*ack_bytes <= 32)
 		{
 			// read the entire payload
-			nRF_ReadRxPayload(ack_bytes);
-
-			// copy up to buff_size bytes
-			ret_val = ack_bytes < buff_size ? ack_bytes : buff_size;
-			memcpy(buff, nRF_data + 1, ret_val);
+			nRF_ReadRxPayload(*ack_bytes);
+			ret_val = nRF_data + 1;
 		} else {
 			nRF_FlushRX();
 		}
 	}
 
+	clock_slow();
+	
 	return ret_val;
 }
 
+uint8_t rf_ctrl_read_ack_payload(void* buff, const uint8_t buff_size)
+{
+	uint8_t ack_bytes;
+	const uint8_t* payload = read_ack_payload_direct(&ack_bytes);
+	if (payload == NULL)
+		return 0;
+
+	// copy up to buff_size bytes
+	if (ack_bytes > buff_size)
+		ack_bytes = buff_size;
+	
+	memcpy(buff, payload, ack_bytes);
+
+	return ack_bytes;
+}
+
 void rf_ctrl_get_observe(uint8_t* arc, uint8_t* plos)
 {
 	nRF_ReadReg(OBSERVE_TX);
@@ -181,15 +457,16 @@ void rf_ctrl_get_observe(uint8_t* arc, uint8_t* plos)
 		*plos = nRF_data[1] >> 4;
 }
 
-bool rf_ctrl_process_ack_payloads(uint8_t* msg_buff_free, uint8_t* msg_buff_capacity)
+bool rf_ctrl_process_ack_payloads(uint16_t* msg_buff_free, uint16_t* msg_buff_capacity)
 {
 	// set defaults
 	if (msg_buff_free)		*msg_buff_free = 0;
 	if (msg_buff_capacity)	*msg_buff_capacity = 0;
 
 	bool ret_val = false;
-	uint8_t buff[3];
-	while (rf_ctrl_read_ack_payload(buff, sizeof buff))
+	const uint8_t* buff;
+	uint8_t ack_bytes;
+	while ((buff = read_ack_payload_direct(&ack_bytes)) != NULL)
 	{
 		if (buff[0] == MT_LED_STATUS)
 		{
@@ -200,15 +477,330 @@ bool rf_ctrl_process_ack_payloads(uint8_t* msg_buff_free, uint8_t* msg_buff_capa
 			ret_val = true;
 			
 			// make a proper message pointer
-			rf_msg_text_buff_state_t* msg_free_buff = (rf_msg_text_buff_state_t*) buff;
+			const rf_msg_text_buff_state_t* msg_free_buff = (const rf_msg_text_buff_state_t*) buff;
+			
+			// the dongle sends this after every text message, so it is the state after
+			// the last chunk we sent; the dongle's buffer can only have emptied since then
+			dongle_text_free = msg_free_buff->bytes_free;
+			dongle_text_free_valid = true;
 			
 			if (msg_buff_free)
 				*msg_buff_free = msg_free_buff->bytes_free;
 				
 			if (msg_buff_capacity)
 				*msg_buff_capacity = msg_free_buff->bytes_capacity;
+
+		} else if (buff[0] == MT_TIMING_BEACON) {
+
+			const rf_msg_timing_beacon_t* beacon = (const rf_msg_timing_beacon_t*) buff;
+			usb_sync_beacon(beacon_ref_tick, beacon_ref_was_up, beacon->wait_us);
 		}
 	}
 	
 	return ret_val;
 }
+
+void rf_ctrl_queue_message(uint8_t prio, const void* buff, const uint8_t num_bytes)
+{
+	rf_queue[prio].len = num_bytes;
+	memcpy(rf_queue[prio].data, buff, num_bytes);
+
+	// don't let a key press wait for a backed off ping
+	if (prio == RF_PRIO_KEY_STATE)
+		link_activity(get_ticks());
+}
+
+bool rf_ctrl_queue_text(uint8_t c)
+{
+	if ((uint8_t)(text_queue_head - text_queue_tail) == TEXT_QUEUE_SIZE)
+		return false;
+	
+	text_queue[text_queue_head & TEXT_QUEUE_MASK] = c;
+	++text_queue_head;
+	
+	return true;
+}
+
+bool rf_ctrl_is_queue_empty(void)
+{
+	if (key_state_resend_due  ||  keep_alive_due)
+		return false;
+
+	uint8_t prio;
+	for (prio = 0; prio < RF_PRIO_TEXT; ++prio)
+	{
+		if (rf_queue[prio].len)
+			return false;
+	}
+
+	return text_chunk_len == 0  &&  text_queue_head == text_queue_tail;
+}
+
+// takes the next chunk of text from the text queue
+void make_text_chunk(void)
+{
+	uint8_t c, entry_len;
+
+	text_chunk_expanded = 0;
+	while (text_chunk_len < MAX_TEXT_LEN  &&  text_queue_head != text_queue_tail)
+	{
+		c = text_queue[text_queue_tail & TEXT_QUEUE_MASK];
+
+		entry_len = 1;
+		if (IS_TEXT_DICT_TOKEN(c)  &&  text_dict_entry(c, &entry_len) == NULL)
+			entry_len = 0;
+
+		// keep the expanded chunk small enough for the dongle's buffer
+		if (text_chunk_expanded + entry_len > 0xff - 1)
+			break;
+
+		text_chunk.text[text_chunk_len++] = c;
+		text_chunk_expanded += entry_len;
+		++text_queue_tail;
+	}
+}
+
+// sends one text packet: either a query for the dongle's free space, or the next chunk
+rf_queue_result_t send_text_step(void)
+{
+	if (text_chunk_len == 0)
+	{
+		make_text_chunk();
+		if (text_chunk_len == 0)
+			return RF_QUEUE_IDLE;
+	}
+
+	text_chunk.msg_type = MT_TEXT;
+
+	if (!dongle_text_free_valid)
+	{
+		// give the dongle some time to type out its buffer before asking again
+		if (timer_is_active(TIMER_TEXT_RETRY))
+			return RF_QUEUE_IDLE;
+		
+		// send an empty text message; this causes the dongle to respond with ACK payload
+		// that contains the number of bytes available in the dongle's text buffer
+		if (!rf_ctrl_send_message(&text_chunk, 2))		// 1 byte for the message type ID, 1 for the msg_id
+			return RF_QUEUE_FAILED;
+
+		rf_ctrl_process_ack_payloads(NULL, NULL);
+
+		return RF_QUEUE_SENT;
+	}
+
+	// not enough space in the dongle buffer?
+	if (dongle_text_free <= text_chunk_expanded + 1)
+	{
+		dongle_text_free_valid = false;
+		timer_start(TIMER_TEXT_RETRY, 40, 0, NULL);		// roughly 10ms
+		return RF_QUEUE_IDLE;
+	}
+	
+	// set the message id and send it on it's way
+	text_msg_id = text_msg_id == 0xff ? 1 : text_msg_id + 1;
+	text_chunk.msg_id = text_msg_id;
+	if (!rf_ctrl_send_message(&text_chunk, text_chunk_len + 2))
+		return RF_QUEUE_FAILED;
+
+	text_chunk_len = 0;
+
+	// the ACK to the chunk carries the free space from before the chunk, so it's stale
+	rf_ctrl_process_ack_payloads(NULL, NULL);
+	dongle_text_free_valid = false;
+
+	return RF_QUEUE_SENT;
+}
+
+// sends the last key state again
+rf_queue_result_t send_last_key_state(void)
+{
+	key_state_resend_due = false;
+
+	if (!rf_ctrl_send_message(&last_key_state, last_key_state_len))
+		return RF_QUEUE_FAILED;
+
+	rf_ctrl_process_ack_payloads(NULL, NULL);
+
+	return RF_QUEUE_SENT;
+}
+
+void keep_alive_timer(void)
+{
+	keep_alive_due = true;
+}
+
+rf_queue_result_t send_keep_alive(void)
+{
+	uint8_t msg_type = MT_KEEP_ALIVE;
+
+	keep_alive_due = false;
+
+	if (!rf_ctrl_send_message(&msg_type, 1))
+		return RF_QUEUE_FAILED;
+
+	rf_ctrl_process_ack_payloads(NULL, NULL);
+
+	return RF_QUEUE_SENT;
+}
+
+// the keep-alives go out while the last key state has keys down
+void restart_keep_alive(void)
+{
+	keep_alive_due = false;
+	if (last_key_state.modifiers  ||  last_key_state.consumer  ||  last_key_state_len > 3)
+		timer_start(TIMER_KEEP_ALIVE, KEEP_ALIVE_TICKS, KEEP_ALIVE_TICKS, keep_alive_timer);
+	else
+		timer_stop(TIMER_KEEP_ALIVE);
+}
+
+rf_queue_result_t send_key_state(const uint8_t* data, uint8_t len)
+{
+	memcpy(&last_key_state, data, len);
+	last_key_state_len = len;
+
+	// this one counts as a keep-alive too
+	restart_keep_alive();
+
+	return send_last_key_state();
+}
+
+void rf_ctrl_suspend(void)
+{
+	timer_stop(TIMER_KEEP_ALIVE);
+	keep_alive_due = false;
+
+	// the lock loop doesn't go through the idle loop, and we won't send anything
+	rf_ctrl_power_down();
+}
+
+void rf_ctrl_resume(void)
+{
+	restart_keep_alive();
+}
+
+rf_queue_result_t send_heartbeat(void)
+{
+	rf_msg_heartbeat_t msg;
+
+	last_heartbeat = get_ticks();
+
+	msg.msg_type = MT_HEARTBEAT;
+	msg.battery_voltage = get_battery_voltage();
+	msg.battery_level = get_battery_level();
+	msg.packets = rf_packets_total;
+	msg.lost_packets = plos_total;
+	msg.retransmits = arc_total;
+	msg.link_losses = link_get_losses();
+
+	if (!rf_ctrl_send_message(&msg, sizeof msg))
+		return RF_QUEUE_FAILED;
+
+	// the LED status
+	rf_ctrl_process_ack_payloads(NULL, NULL);
+
+	return RF_QUEUE_SENT;
+}
+
+rf_queue_result_t rf_ctrl_send_queued(void)
+{
+	uint8_t prio, len;
+	rf_queue_result_t ret_val;
+
+	// the dongle is gone; the messages wait, and only the pings go out
+	if (!link_is_up())
+	{
+		if (!link_probe_due(get_ticks())  ||  !send_probe())
+			return RF_QUEUE_IDLE;
+
+		rf_ctrl_process_ack_payloads(NULL, NULL);
+
+		// the dongle has released the keys by now (see LINK_TIMEOUT_MS), so
+		// send the key state again unless there's a newer one waiting
+		if (last_key_state_len  &&  rf_queue[RF_PRIO_KEY_STATE].len == 0)
+			key_state_resend_due = true;
+
+		return RF_QUEUE_SENT;
+	}
+
+	// the highest priority message first
+	for (prio = 0; prio < RF_PRIO_TEXT; ++prio)
+	{
+		len = rf_queue[prio].len;
+		if (len)
+		{
+			rf_queue[prio].len = 0;
+
+			if (prio == RF_PRIO_KEY_STATE)
+				return send_key_state(rf_queue[prio].data, len);
+			
+			if (!rf_ctrl_send_message(rf_queue[prio].data, len))
+				return RF_QUEUE_FAILED;
+
+			rf_ctrl_process_ack_payloads(NULL, NULL);
+
+			return RF_QUEUE_SENT;
+		}
+	}
+
+	if (key_state_resend_due)
+		return send_last_key_state();
+
+	if (keep_alive_due)
+		return send_keep_alive();
+
+	ret_val = send_text_step();
+
+	// the heartbeat when there's nothing else to send
+	if (ret_val == RF_QUEUE_IDLE  &&  get_heartbeat()  &&  get_ticks() - last_heartbeat >= get_heartbeat_ticks())
+		return send_heartbeat();
+	
+	// we can't get the text through, so drop it
+	if (ret_val == RF_QUEUE_FAILED)
+	{
+		text_queue_tail = text_queue_head;
+		text_chunk_len = 0;
+		dongle_text_free_valid = false;
+	}
+
+	return ret_val;
+}
+
+bool rf_ctrl_wait_for_link(uint16_t max_sec)
+{
+	uint16_t started = get_seconds();
+
+	link_activity(get_ticks());
+	while (!link_is_up())
+	{
+		if (get_seconds() - started >= max_sec)
+			return false;
+
+		if (rf_ctrl_send_queued() == RF_QUEUE_IDLE)
+		{
+			rf_ctrl_power_down_if_due();
+			sleep_ticks(40);		// doze off a little; roughly 10ms
+		}
+	}
+
+	return true;
+}
+
+bool rf_ctrl_flush_queue(void)
+{
+	rf_queue_result_t result;
+
+	while (!rf_ctrl_is_queue_empty())
+	{
+		result = rf_ctrl_send_queued();
+		if (result == RF_QUEUE_FAILED  ||  !link_is_up())
+			return false;
+
+		if (result == RF_QUEUE_IDLE)
+		{
+			rf_ctrl_power_down_if_due();
+			sleep_ticks(40);		// doze off a little; roughly 10ms
+		}
+	}
+	
+	return true;
+}
@@ -8,8 +8,52 @@ void rf_ctrl_init(void);
 // LED status will be set to LED_STATUS_NOT_RECEIVED if no status has been received
 #define LED_STATUS_NOT_RECEIVED	0xff
 
+// a message that is not ACKed after all the attempts marks the link as lost (see link.h)
 bool rf_ctrl_send_message(const void* buff, const uint8_t num_bytes);
 
+// the nRF is left powered up after a message; rf_ctrl_power_down_if_due() in the
+// idle loop powers it down after get_nrf_hold_ticks(), or call rf_ctrl_power_down()
+// to do it now
+void rf_ctrl_power_down(void);
+void rf_ctrl_power_down_if_due(void);
+
 uint8_t rf_ctrl_read_ack_payload(void* buff, const uint8_t buff_size);
 
-bool rf_ctrl_process_ack_payloads(uint8_t* msg_buff_free, uint8_t* msg_buff_capacity);
\ No newline at end of file
+bool rf_ctrl_process_ack_payloads(uint16_t* msg_buff_free, uint16_t* msg_buff_capacity);
+
+// the outgoing message queue; the lower the number the higher the priority
+// a new kind of message gets a priority before RF_PRIO_TEXT
+#define RF_PRIO_KEY_STATE	0
+#define RF_PRIO_TEXT		1		// text is queued with rf_ctrl_queue_text()
+
+typedef enum
+{
+	RF_QUEUE_IDLE,		// nothing was sent: the queue is empty, we are waiting for the dongle, or the link is lost
+	RF_QUEUE_SENT,		// a packet was sent
+	RF_QUEUE_FAILED,	// a packet was not ACKed; if it was text, the queued text is dropped
+} rf_queue_result_t;
+
+// queues a message; it replaces the message of the same priority that is still waiting
+void rf_ctrl_queue_message(uint8_t prio, const void* buff, const uint8_t num_bytes);
+
+// queues a char or a dictionary token of text; returns false if the text queue is full
+bool rf_ctrl_queue_text(uint8_t c);
+
+bool rf_ctrl_is_queue_empty(void);
+
+// sends the next queued packet: the highest priority message,
+// or the next step of the text if nothing else is waiting
+// With get_heartbeat() it also sends the heartbeat when nothing else is waiting.
+rf_queue_result_t rf_ctrl_send_queued(void);
+
+// sends everything in the queue; returns false if a message could not be sent
+// or the link is lost
+bool rf_ctrl_flush_queue(void);
+
+// pings the dongle until the link is up; returns false if it's still lost after max_sec
+bool rf_ctrl_wait_for_link(uint16_t max_sec);
+
+// stops the keep-alives and powers down the nRF while the keyboard is locked; the dongle
+// releases the keys after LINK_TIMEOUT_MS. rf_ctrl_resume() starts them again if keys are down.
+void rf_ctrl_suspend(void);
+void rf_ctrl_resume(void);
\ No newline at end of file
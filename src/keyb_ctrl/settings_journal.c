@@ -0,0 +1,75 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+
+#include "settings_journal.h"
+
+#define NUM_SLOTS					((E2END + 1) / sizeof(settings_record_t))
+
+settings_record_t EEMEM settings_journal[NUM_SLOTS];
+
+uint8_t settings_slot = NUM_SLOTS - 1;	// the slot of the last save; the first save goes to 0
+
+uint8_t calc_settings_crc(const settings_record_t* rec)
+{
+	const uint8_t* ptr = (const uint8_t*) rec;
+	uint8_t crc = 0, cnt;
+	for (cnt = 0; cnt < sizeof(settings_record_t) - 1; ++cnt)
+		crc = _crc8_ccitt_update(crc, *ptr++);
+
+	return crc;
+}
+
+bool journal_load(settings_record_t* rec, const settings_record_t* defaults)
+{
+	settings_record_t slot_rec;
+	bool found = false;
+	uint8_t slot;
+	for (slot = 0; slot < NUM_SLOTS; ++slot)
+	{
+		eeprom_read_block(&slot_rec, &settings_journal[slot], sizeof(settings_record_t));
+		
+		if (slot_rec.version != SETTINGS_VERSION  ||  slot_rec.crc != calc_settings_crc(&slot_rec))
+			continue;
+
+		// the sequence numbers of the valid slots are at most NUM_SLOTS apart
+		if (!found  ||  (int8_t)(slot_rec.seq - rec->seq) > 0)
+		{
+			*rec = slot_rec;
+			settings_slot = slot;
+			found = true;
+		}
+	}
+
+	if (!found)
+		return false;
+
+	// an older firmware saved this; the settings added since get the defaults
+	if (rec->size < SETTINGS_SIZE)
+	{
+		uint8_t from = rec->size < offsetof(settings_record_t, led_brightness)
+							? offsetof(settings_record_t, led_brightness) : rec->size;
+		memcpy((uint8_t*) rec + from, (const uint8_t*) defaults + from, SETTINGS_SIZE - from);
+	}
+
+	// a newer firmware saves its own settings, we only save ours
+	rec->size = SETTINGS_SIZE;
+
+	return true;
+}
+
+void journal_save(settings_record_t* rec)
+{
+	if (++settings_slot >= NUM_SLOTS)
+		settings_slot = 0;
+	
+	++rec->seq;
+	rec->version = SETTINGS_VERSION;
+	rec->size = SETTINGS_SIZE;
+	rec->crc = calc_settings_crc(rec);
+	
+	eeprom_update_block(rec, &settings_journal[settings_slot], sizeof(settings_record_t));
+}
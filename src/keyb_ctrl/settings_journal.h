@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stddef.h>
+
+// The EEPROM is a journal of settings_record_t slots. Every save writes the whole
+// record into the slot after the newest one, so the writes are spread over all
+// the slots. The newest valid slot is found by the sequence number at boot.
+// A record with a bad CRC (a write interrupted by a battery change) or of another
+// version is skipped.
+//
+// The slots have a fixed size, and new settings are appended in the reserved
+// bytes. A record saved by an older firmware has a smaller size; the settings
+// it doesn't have are taken from the defaults, and the rest is kept.
+// SETTINGS_VERSION changes only if the meaning of a saved byte changes.
+//
+// There's no AVR specific code in here apart from avr/eeprom.h; the host test
+// (src/host/settings_test.c) builds it with a RAM EEPROM.
+
+#define SETTINGS_VERSION			4
+
+typedef struct
+{
+	uint8_t		seq;				// incremented with every save
+	uint8_t		version;
+	uint8_t		size;				// the bytes up to the last setting the firmware knew
+	uint8_t		led_brightness;
+	uint8_t		nrf_output_power;
+	uint8_t		sleep_profile;
+	uint8_t		deep_sleep_minutes;
+	uint8_t		osccal;
+	uint8_t		usb_sync;
+	uint8_t		unused;				// was the blast mode; keeps the later fields in place
+	uint8_t		heartbeat;
+	uint8_t		reserved[4];		// for the new settings; the slots are 16 bytes
+	uint8_t		crc;				// CRC-8 of the bytes above
+} settings_record_t;
+
+#define SETTINGS_SIZE				offsetof(settings_record_t, reserved)
+
+uint8_t calc_settings_crc(const settings_record_t* rec);
+
+// reads the newest valid record into rec, and fills the settings it doesn't
+// have from defaults; returns false and leaves rec alone if there's none
+bool journal_load(settings_record_t* rec, const settings_record_t* defaults);
+
+// writes rec into the next slot; this waits for the EEPROM, so don't call it
+// from a timer callback
+void journal_save(settings_record_t* rec);
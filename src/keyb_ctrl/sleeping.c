@@ -8,6 +8,14 @@
 #include "sleeping.h"
 #include "matrix.h"
 #include "led.h"
+#include "rf_ctrl.h"
+#include "ctrl_settings.h"
+#include "cadence.h"
+#include "osccal.h"
+#include "energy.h"
+#include "battery.h"
+#include "usb_sync.h"
+#include "hw_setup.h"
 #include "avrutils.h"
 #include "avrdbg.h"
 
@@ -63,6 +71,8 @@ void init_sleep(void)
 	// the AVR draws about 6uA in power save mode
 	set_sleep_mode(SLEEP_MODE_PWR_SAVE);
 
+	select_sleep_profile(get_sleep_profile());
+
 	// config the wake-up timer; the timer is set to normal mode
 	TCCR2A = 	//_BV(CS20);				// no prescaler
 											// TCNT=30.517578125us  OVF=7.8125ms
@@ -111,23 +121,222 @@ void add_ticks(uint16_t ticks)
 	watch.tcnt2_lword += ticks;
 }
 
+// While the LEDs are on Timer2 runs without the prescaler, and its overflow
+// paces the LED PWM. We sleep for whole overflows (frames) in this mode.
+#define FRAME_TICKS		32		// the frame in watch ticks (244us); 7.8125ms
+#define FAST_TICK_SHIFT	3		// the fast ticks are 8 times shorter
+
+bool is_timer2_fast = false;
+volatile uint8_t fast_frames = 0;		// counts the Timer2 overflows in the fast mode
+uint8_t fast_frames_counted;			// the overflows already added to the watch
+
 // Timer2 overflow interrupt wakes us from sleep
 ISR(TIMER2_OVF_vect)
-{}
+{
+	if (is_timer2_fast)
+	{
+		++fast_frames;
+		led_pwm_frame();
+	}
+}
 
-// sleep for sleep_ticks number of TCNT2 ticks
-void sleep_ticks(uint8_t ticks)
+void wait_for_timer2_update(void)
+{
+	while (ASSR & (_BV(TCN2UB) | _BV(OCR2UB) | _BV(TCR2UB)))
+		;
+}
+
+void add_fast_frames(void)
+{
+	uint8_t frames = fast_frames;
+	add_ticks((uint8_t)(frames - fast_frames_counted) * FRAME_TICKS);
+	fast_frames_counted = frames;
+}
+
+void timer2_fast(void)
+{
+	if (is_timer2_fast)
+		return;
+		
+	add_ticks(TCNT2);		// the time we've been awake
+
+	TCCR2A = _BV(CS20);		// no prescaler
+	TCNT2 = 0;
+	wait_for_timer2_update();
+
+	fast_frames_counted = fast_frames;
+	is_timer2_fast = true;
+}
+
+void timer2_slow(void)
+{
+	if (!is_timer2_fast)
+		return;
+		
+	is_timer2_fast = false;
+	
+	add_fast_frames();
+	add_ticks(TCNT2 >> FAST_TICK_SHIFT);
+
+	TCCR2A = _BV(CS21);		// 8 prescaler, same as in init_sleep()
+	TCNT2 = 0;
+	wait_for_timer2_update();
+}
+
+// the watch in ticks without TCNT2; right after a wake-up TCNT2 can still read
+// the value from before the sleep
+uint32_t watch_ticks(void)
+{
+	uint32_t ret_val = watch.tcnt2_hword;
+	ret_val <<= 16;
+	ret_val |= watch.tcnt2_lword;
+
+	return ret_val;
+}
+
+// returns the watch in ticks, including the time we've been awake since the last sleep
+uint32_t get_ticks(void)
+{
+	uint32_t ret_val = watch_ticks();
+
+	if (is_timer2_fast)
+		ret_val += (uint8_t)(fast_frames - fast_frames_counted) * FRAME_TICKS + (TCNT2 >> FAST_TICK_SHIFT);
+	else
+		ret_val += TCNT2;
+
+	return ret_val;
+}
+
+// The software timers. The callbacks are run from sleep_ticks(), so every blocking
+// wait in the firmware serves the timers too. The callbacks must not sleep or send
+// anything over RF; they should set a flag or queue a message and return.
+typedef struct
+{
+	uint32_t			deadline;	// in watch ticks
+	uint16_t			period;		// 0 for one-shot timers
+	timer_callback_t	callback;	// can be NULL
+	bool				is_active;
+} soft_timer_t;
+
+soft_timer_t timers[NUM_TIMERS];
+
+// the earliest deadline of the active timers
+// without active timers it is just far away and gets updated when it passes
+uint32_t next_deadline = 0;
+
+void find_next_deadline(uint32_t now)
+{
+	next_deadline = now + 0x10000;
+
+	uint8_t id;
+	for (id = 0; id < NUM_TIMERS; ++id)
+	{
+		if (timers[id].is_active  &&  (int32_t)(timers[id].deadline - next_deadline) < 0)
+			next_deadline = timers[id].deadline;
+	}
+}
+
+void timer_start(timer_id_t id, uint16_t ticks, uint16_t period, timer_callback_t callback)
+{
+	uint32_t now = get_ticks();
+	
+	timers[id].deadline = now + ticks;
+	timers[id].period = period;
+	timers[id].callback = callback;
+	timers[id].is_active = true;
+
+	find_next_deadline(now);
+}
+
+void timer_stop(timer_id_t id)
+{
+	timers[id].is_active = false;
+}
+
+bool timer_is_active(timer_id_t id)
+{
+	return timers[id].is_active;
+}
+
+void run_timers(void)
+{
+	uint32_t now = get_ticks();
+	soft_timer_t* timer;
+	uint8_t id;
+	for (id = 0; id < NUM_TIMERS; ++id)
+	{
+		timer = timers + id;
+		if (timer->is_active  &&  (int32_t)(now - timer->deadline) >= 0)
+		{
+			if (timer->period)
+				timer->deadline += timer->period;
+			else
+				timer->is_active = false;
+				
+			if (timer->callback)
+				timer->callback();
+		}
+	}
+
+	find_next_deadline(now);
+}
+
+// the watch when we last woke up; the time since then is awake time
+uint32_t awake_since = 0;
+
+// adds the time since the last wake-up to energy_awake_ticks; call before sleeping
+void count_awake(void)
+{
+	uint32_t now = get_ticks();
+	if ((int32_t)(now - awake_since) > 0)
+		energy_awake_ticks += now - awake_since;
+	awake_since = now;
+}
+
+// sleep for sleep_ticks number of TCNT2 ticks, without looking at the timers
+void sleep_timer2(uint8_t ticks)
 {
 	if (are_leds_on())
 	{
-		uint8_t prev_ticks = TCNT2;
-		
-		while (ticks--)
-			_delay_us(244.14);
+		timer2_fast();
+
+		// round to the frames; shorter than half a frame is a busy wait
+		uint8_t frames = (ticks + FRAME_TICKS / 2) / FRAME_TICKS;
+		if (frames == 0)
+		{
+			// awake all the time; the next count_awake() counts it
+			while (ticks--)
+				_delay_us(244.14);
+		} else {
+			count_awake();
+			
+			uint8_t start = fast_frames;
+			sleep_enable();
+			for (;;)
+			{
+				// the sleep is cut short if the LEDs go off
+				cli();
+				if ((uint8_t)(fast_frames - start) >= frames  ||  !are_leds_on())
+					break;
+				sei();
+				sleep_cpu();		// sei() lets one more instruction execute, so we don't miss the wake-up
+			}
+			sei();
+			sleep_disable();
 			
-		add_ticks(ticks - prev_ticks);
+			add_fast_frames();
+			awake_since = watch_ticks();
+		}
+		
+		add_fast_frames();
 	} else {
+		if (is_timer2_fast)
+			timer2_slow();
+			
 		sleep_enable();
+		
+		// the time we've been awake
+		count_awake();
 		add_ticks(TCNT2);
 		
 		TCNT2 = 0xff - ticks;					// set the sleep duration
@@ -136,10 +345,130 @@ void sleep_ticks(uint8_t ticks)
 		add_ticks(ticks);
 		sleep_mode();				// go to sleep
 		sleep_disable();
+		
+		awake_since = watch_ticks();
 	}
 }
 
-const __flash sleep_schedule_period_t sleep_schedule_default[] =
+// sleep for sleep_ticks number of TCNT2 ticks
+// the timers that expire in the meantime are run
+void sleep_ticks(uint8_t ticks)
+{
+	uint32_t now = get_ticks();
+	uint32_t wake_up = now + ticks;
+
+	// the usual case: no timer expires before we wake up
+	if ((int32_t)(next_deadline - wake_up) > 0)
+	{
+		sleep_timer2(ticks);
+		return;
+	}
+
+	int32_t ticks_left, ticks_to_next;
+	for (;;)
+	{
+		run_timers();
+
+		now = get_ticks();
+		ticks_left = wake_up - now;
+		if (ticks_left <= 0)
+			break;
+
+		ticks_to_next = next_deadline - now;
+		if (ticks_to_next < ticks_left)
+			ticks_left = ticks_to_next < 1 ? 1 : ticks_to_next;
+
+		sleep_timer2(ticks_left);
+	}
+}
+
+// the nRF's IRQ pin PE6 is PCINT6; its pin change only wakes us up
+EMPTY_INTERRUPT(PCINT0_vect);
+
+#define nrf_irq_active()	((PIN(NRF_IRQ_PORT) & _BV(NRF_IRQ_BIT)) == 0)
+
+void sleep_until_nrf_irq(uint8_t ticks)
+{
+	PCMSK0 |= _BV(PCINT6);
+	EIFR = _BV(PCIF0);
+	EIMSK |= _BV(PCIE0);
+
+	sleep_enable();
+
+	if (are_leds_on())
+	{
+		timer2_fast();
+		count_awake();
+
+		// wake up on the IRQ or after the frames
+		uint8_t frames = ticks / FRAME_TICKS + 1;
+		uint8_t start = fast_frames;
+		for (;;)
+		{
+			cli();
+			if (nrf_irq_active()  ||  (uint8_t)(fast_frames - start) >= frames  ||  !are_leds_on())
+				break;
+			sei();
+			sleep_cpu();
+		}
+		sei();
+		
+		// the IRQ wakes us in the middle of a frame; see below
+		TCCR2A = TCCR2A;
+		wait_for_timer2_update();
+		
+		add_fast_frames();
+	} else {
+		if (is_timer2_fast)
+			timer2_slow();
+			
+		// the time we've been awake
+		count_awake();
+		add_ticks(TCNT2);
+
+		// the count after the overflow below must not catch up with the start
+		if (ticks > 0xf0)
+			ticks = 0xf0;
+
+		uint8_t start = 0xff - ticks;
+		TCNT2 = start;
+		loop_until_bit_is_clear(ASSR, TCN2UB);
+
+		cli();
+		if (!nrf_irq_active())
+		{
+			sei();
+			sleep_cpu();
+		}
+		sei();
+
+		// We don't know how long we slept if the IRQ woke us up. TCNT2 reads the
+		// value from before the sleep until the next TOSC1 edge, so wait for that.
+		TCCR2A = TCCR2A;
+		wait_for_timer2_update();
+
+		// this is right after the overflow too: TCNT2 wrapped to the ticks since then
+		add_ticks((uint8_t)(TCNT2 - start));
+		TCNT2 = 0;
+		loop_until_bit_is_clear(ASSR, TCN2UB);
+	}
+
+	sleep_disable();
+	awake_since = get_ticks();
+	
+	EIMSK &= ~_BV(PCIE0);
+	PCMSK0 &= ~_BV(PCINT6);
+}
+
+// the sleep profiles; see SLEEP_PROFILE_* in sleeping.h
+const __flash sleep_schedule_period_t sleep_schedule_gaming[] =
+{
+	{   900,    8},		// 15 minutes, ~2ms refresh
+	{  3600,   24},		// 1 hour, ~6ms refresh
+	{0xffff,   82},		// forever, ~20ms refresh
+};
+
+const __flash sleep_schedule_period_t sleep_schedule_balanced[] =
 {
 	{   300,   24},		// 5 minutes, ~6ms refresh
 	{   900,   33},		// 15 minutes, ~8ms refresh
@@ -147,7 +476,31 @@ const __flash sleep_schedule_period_t sleep_schedule_default[] =
 	{0xffff,  250},		// forever, ~62ms refresh
 };
 
-const __flash sleep_schedule_period_t* active_sleep_schedule = sleep_schedule_default;
+const __flash sleep_schedule_period_t sleep_schedule_battery[] =
+{
+	{    60,   41},		// 1 minute, ~10ms refresh
+	{   300,   82},		// 5 minutes, ~20ms refresh
+	{0xffff,  250},		// forever, ~62ms refresh
+};
+
+const __flash sleep_schedule_period_t* const __flash sleep_profiles[NUM_SLEEP_PROFILES] =
+{
+	sleep_schedule_gaming,
+	sleep_schedule_balanced,
+	sleep_schedule_battery,
+};
+
+// the longest time the nRF is kept powered up between packets
+// the battery profile never spends more than a power up would cost
+const __flash uint16_t nrf_hold_max_ticks[NUM_SLEEP_PROFILES] =
+{
+	8192,						// gaming, 2 sec
+	2048,						// balanced, 0.5 sec
+	NRF_BREAK_EVEN_TICKS,		// battery, ~23ms
+};
+
+uint8_t active_sleep_profile = SLEEP_PROFILE_BALANCED;
+const __flash sleep_schedule_period_t* active_sleep_schedule = sleep_schedule_balanced;
 const __flash sleep_schedule_period_t* curr_sleep_period;
 uint16_t sleep_period_started = 0;
 
@@ -169,7 +522,15 @@ void sleep_dynamic(void)
 		}
 	}
 
-	sleep_ticks(curr_sleep_period->num_ticks);
+	// the predictor picks the interval; in a pause it ramps up to the schedule's
+	uint32_t now = get_ticks();
+	uint8_t ticks = cadence_next_ticks(now, active_sleep_schedule->num_ticks, curr_sleep_period->num_ticks);
+	
+	// while typing, scan in time for the host's next poll of the dongle
+	if (get_usb_sync()  &&  usb_sync_is_valid(now))
+		ticks = usb_sync_align(now, ticks);
+	
+	sleep_ticks(ticks);
 }
 
 // sleep for the entire sleep period a given number of times
@@ -179,37 +540,123 @@ void sleep_max(uint8_t num_times)
 		sleep_ticks(0xfe);
 }
 
+void select_sleep_profile(uint8_t profile)
+{
+	if (profile >= NUM_SLEEP_PROFILES)
+		profile = SLEEP_PROFILE_BALANCED;
+		
+	active_sleep_profile = profile;
+	active_sleep_schedule = sleep_profiles[profile];
+	sleep_reset();
+}
+
+uint16_t get_scan_latency_us(void)
+{
+	return active_sleep_schedule->num_ticks * 244UL;
+}
+
+uint32_t get_wakeups_per_hour(void)
+{
+	// count the scans in the first hour after the last key press
+	const __flash sleep_schedule_period_t* period = active_sleep_schedule;
+	uint32_t wakeups = 0;
+	uint16_t seconds, seconds_left = 3600;
+	while (seconds_left)
+	{
+		seconds = period->duration_sec < seconds_left ? period->duration_sec : seconds_left;
+		wakeups += seconds * 4096UL / period->num_ticks;		// 4096 ticks per second
+		seconds_left -= seconds;
+		++period;
+	}
+
+	return wakeups;
+}
+
+uint16_t get_nrf_hold_ticks(void)
+{
+	// long enough for the next press in the burst
+	uint16_t ret_val = cadence_get_interval() * 2;
+	uint16_t max_ticks = nrf_hold_max_ticks[active_sleep_profile];
+
+	if (ret_val < NRF_BREAK_EVEN_TICKS)
+		ret_val = NRF_BREAK_EVEN_TICKS;
+	if (ret_val > max_ticks)
+		ret_val = max_ticks;
+
+	return ret_val;
+}
+
+uint32_t get_heartbeat_ticks(void)
+{
+	uint32_t ret_val = curr_sleep_period->num_ticks * (uint32_t) HEARTBEAT_SCANS;
+
+	return ret_val < HEARTBEAT_MIN_TICKS ? HEARTBEAT_MIN_TICKS : ret_val;
+}
+
 void sleep_reset(void)
 {
 	curr_sleep_period = active_sleep_schedule;
 	sleep_period_started = get_seconds();
 }
 
+// sends the next queued RF packet between the scans, or sleeps if there's nothing to send
+// this is what keeps the text going out while we wait for the keys
+void send_queued_or_sleep(void)
+{
+	if (rf_ctrl_send_queued() != RF_QUEUE_SENT)
+	{
+		rf_ctrl_power_down_if_due();
+		sleep_dynamic();
+	}
+}
+
+// scans the matrix and tells the cadence predictor about the changes
+bool scan_matrix(void)
+{
+	if (!matrix_scan())
+		return false;
+
+	cadence_key_event(get_ticks(), get_num_keys_pressed());
+
+	return true;
+}
+
 void wait_for_all_keys_up(void)
 {
 	sleep_reset();
-	matrix_scan();
+	scan_matrix();
 	while (get_num_keys_pressed())
 	{
-		sleep_dynamic();
-		matrix_scan();
+		send_queued_or_sleep();
+		scan_matrix();
 	}
 }
 
 void wait_for_key_down(void)
 {
 	sleep_reset();
-	matrix_scan();
+	scan_matrix();
 	while (get_num_keys_pressed() == 0)
 	{
-		sleep_dynamic();
-		matrix_scan();
+		send_queued_or_sleep();
+		scan_matrix();
 	}
 }
 
-void wait_for_matrix_change(void)
+bool wait_for_matrix_change(uint16_t max_idle_sec)
 {
 	sleep_reset();
-	while (!matrix_scan())
-		sleep_dynamic();
+	uint16_t idle_started = get_seconds();
+	while (!scan_matrix())
+	{
+		if (max_idle_sec  &&  get_seconds() - idle_started >= max_idle_sec)
+			return false;
+			
+		osccal_calibrate_if_due(get_seconds() - idle_started);
+		battery_check();
+		save_settings_if_due();
+		send_queued_or_sleep();
+	}
+	
+	return true;
 }
@@ -8,14 +8,55 @@ void init_sleep(void);
 void sleep_dynamic(void);
 
 // sleep for the number of Timer0 counter cycles
+// while the LEDs are on the sleep is rounded to the 7.8ms LED PWM frames
 void sleep_ticks(uint8_t sleep_cnt);
 
+// sleeps until the nRF's IRQ goes active, but at most about ticks
+// the pin change interrupt wakes us up; the timers are not run
+void sleep_until_nrf_irq(uint8_t ticks);
+
+// runs the Timer2 without the prescaler for the LED PWM
+// sleep_ticks() sets it back when the LEDs go off
+void timer2_fast(void);
+
+// back to the 244us ticks; the LEDs have to be off
+void timer2_slow(void);
+
+// the software timers; each user has its own timer
+typedef enum
+{
+	TIMER_TEXT_RETRY,		// rf_ctrl waits for the dongle to make room for the text
+	TIMER_SETTINGS_SAVE,		// ctrl_settings saves the changes to the EEPROM
+	TIMER_NRF_POWER_DOWN,		// the nRF hold time, see rf_ctrl_power_down_if_due()
+	TIMER_KEEP_ALIVE,			// rf_ctrl tells the dongle the keys are still down
+	
+	NUM_TIMERS,
+} timer_id_t;
+
+typedef void (*timer_callback_t)(void);
+
+// starts the timer; it expires in ticks, and then every period ticks if period is not 0
+// the callback (can be NULL) is run from sleep_ticks() when the timer expires
+void timer_start(timer_id_t id, uint16_t ticks, uint16_t period, timer_callback_t callback);
+void timer_stop(timer_id_t id);
+
+// returns false after a one-shot timer has expired
+bool timer_is_active(timer_id_t id);
+
+// runs the callbacks of the expired timers
+void run_timers(void);
+
+// returns the watch in 244us ticks
+uint32_t get_ticks(void);
+
 // sleep for the entire sleep period a given number of times
 void sleep_max(uint8_t num_times);
 
 void wait_for_all_keys_up(void);
 void wait_for_key_down(void);
-void wait_for_matrix_change(void);
+
+// returns false if the matrix did not change for max_idle_sec (0 is forever)
+bool wait_for_matrix_change(uint16_t max_idle_sec);
 
 uint16_t get_seconds(void);
 
@@ -26,6 +67,31 @@ uint16_t get_seconds(void);
 // returns the time since reset
 void get_time(uint16_t* days, uint8_t* hours, uint8_t* minutes, uint8_t* seconds);
 
+// the sleep profiles trade the scan latency for battery life
+#define SLEEP_PROFILE_GAMING		0
+#define SLEEP_PROFILE_BALANCED		1
+#define SLEEP_PROFILE_BATTERY		2
+#define NUM_SLEEP_PROFILES			3
+
+// selects the sleep schedule of a SLEEP_PROFILE_*
+void select_sleep_profile(uint8_t profile);
+
+// the scan interval right after a key press in the active profile
+uint16_t get_scan_latency_us(void);
+
+// the number of scans in the first hour after the last key press in the active profile
+uint32_t get_wakeups_per_hour(void);
+
+// the time the nRF is kept in standby-I after a packet, in ticks
+// it follows the typing cadence, up to the limit of the active profile
+uint16_t get_nrf_hold_ticks(void);
+
+// the time between the heartbeats, in ticks; HEARTBEAT_SCANS scans of the current
+// sleep period, so about 2 sec while typing and a minute after a long idle time
+#define HEARTBEAT_SCANS			1024
+#define HEARTBEAT_MIN_TICKS		8192		// 2 sec
+uint32_t get_heartbeat_ticks(void);
+
 // used to setup sleep schedule
 typedef struct 
 {
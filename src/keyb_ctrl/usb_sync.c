@@ -0,0 +1,57 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "usb_sync.h"
+
+#define US_PER_FRAME		1000
+
+uint16_t in_phase_us;				// where the IN token is in the frame on our clock
+uint32_t last_beacon;
+bool has_beacon = false;
+
+// returns the position of the tick in the 1ms frames of our clock
+// a tick is 15625/64us, so 512 ticks are exactly 125 frames
+uint16_t tick_phase_us(uint32_t tick)
+{
+	return ((tick & 511) * 15625UL / 64) % US_PER_FRAME;
+}
+
+void usb_sync_beacon(uint32_t sent_tick, bool was_powered_up, uint16_t wait_us)
+{
+	// the dongle doesn't know when the host polls yet
+	if (wait_us == 0xffff)
+		return;
+
+	uint16_t lead = was_powered_up ? USB_SYNC_LEAD_UP_US : USB_SYNC_LEAD_DOWN_US;
+
+	in_phase_us = (tick_phase_us(sent_tick) + lead + wait_us) % US_PER_FRAME;
+	last_beacon = sent_tick;
+	has_beacon = true;
+}
+
+bool usb_sync_is_valid(uint32_t now)
+{
+	return has_beacon  &&  now - last_beacon < USB_SYNC_TIMEOUT_TICKS;
+}
+
+uint8_t usb_sync_align(uint32_t now, uint8_t ticks)
+{
+	// the scan phase that gets the report to the dongle in time; we assume the nRF
+	// is in standby-I, because it is while we are typing
+	uint16_t target = (in_phase_us + 2 * US_PER_FRAME - USB_SYNC_LEAD_UP_US - USB_SYNC_MARGIN_US) % US_PER_FRAME;
+
+	// four ticks cover a frame, so one of these is at most a tick before the target
+	uint8_t best = ticks, cnt;
+	uint16_t best_dist = 0xffff, dist;
+	for (cnt = 0; cnt < 4  &&  cnt < ticks; ++cnt)
+	{
+		dist = (target + US_PER_FRAME - tick_phase_us(now + ticks - cnt)) % US_PER_FRAME;
+		if (dist < best_dist)
+		{
+			best_dist = dist;
+			best = ticks - cnt;
+		}
+	}
+
+	return best;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+// The USB frame sync aligns the matrix scans with the host's polls of the dongle.
+//
+// The dongle tells us, in a MT_TIMING_BEACON ACK payload, how long our last
+// key state report waited on the dongle for the host's IN token. From that and
+// the time we sent the report we know where the 1ms USB frames are on our own
+// clock. While typing we then pick the scan times so that a report reaches the
+// dongle just before the next IN token, instead of anywhere in the frame.
+//
+// Our clock is the 244us Timer2 tick, so the alignment is as good as that.
+// The 32KHz crystal and the USB clock drift apart by up to about 100us per
+// second, so the sync is only used for a while after the last beacon.
+//
+// There's no AVR specific code in here; the host benchmark uses it too.
+
+// the time from the wake-up for the scan to the report being read on the dongle
+#define USB_SYNC_LEAD_UP_US			400		// the nRF is in standby-I
+#define USB_SYNC_LEAD_DOWN_US		1900	// the nRF has to start its crystal
+
+// we want the report on the dongle this long before the IN token
+#define USB_SYNC_MARGIN_US			100
+
+// the sync is lost this long after the last beacon; 1 sec
+#define USB_SYNC_TIMEOUT_TICKS		4096
+
+// call with a beacon; sent_tick is the tick of the wake-up the report was sent
+// from, and was_powered_up is true if the nRF was in standby-I at the time
+void usb_sync_beacon(uint32_t sent_tick, bool was_powered_up, uint16_t wait_us);
+
+// returns true if we have a recent beacon
+bool usb_sync_is_valid(uint32_t now);
+
+// returns the ticks to sleep, at most ticks and at least ticks - 3, so that the
+// next scan is just in time for the IN token
+uint8_t usb_sync_align(uint32_t now, uint8_t ticks);